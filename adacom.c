@@ -1,12 +1,21 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/eventfd.h>
 #include <masc.h>
 
 #include "adacom.h"
+#include "trace.h"
+#include "serio.h"
+#include "dlog.h"
 
 
 typedef enum {
     CONN_STEP_GET_INFOS,
     CONN_STEP_GET_STATUS,
+    // Waits for channels beyond the cached number
+    CONN_STEP_CHECK_STATUS,
     CONN_STEP_UNKNOWN
 } ConnectionStep;
 
@@ -16,9 +25,23 @@ typedef enum {
     COMMAND_SET_ALL,
     COMMAND_SAA,
     COMMAND_RESET,
+    COMMAND_STATUS,
     COMMAND_UNKNOWN
 } CommandId;
 
+#define RTT_SAMPLES 256
+// Time in ms the status of a cached connect waits for further channels
+#define STATUS_SETTLE_TIME 20
+
+
+typedef struct {
+    int ch;
+    double value;
+    // Submission time (CLOCK_REALTIME) and send time (CLOCK_MONOTONIC) in ns
+    uint64_t req_ns;
+    uint64_t sent_ns;
+} Unacked;
+
 
 static const char *state_to_cstr[] = {
     [ADACOM_STATE_INITIALISED] = "INITIALISED",
@@ -30,12 +53,28 @@ static const char *state_to_cstr[] = {
 };
 
 
+static const char *cmd_type_to_cstr[] = {
+    [ADACOM_CMD_INFO] = "info",
+    [ADACOM_CMD_STATUS] = "status",
+    [ADACOM_CMD_SET] = "set",
+    [ADACOM_CMD_SET_ALL] = "set-all",
+};
+
+
 // Adaura communiction settings
 static AdaComState state = ADACOM_STATE_UNKNOWN;
 static char *device = NULL;
 static Serial *serial = NULL;
 static MlTimer *com_wdog = NULL;
-static int timeout = 1000;
+// Timeout of the (single line) set commands
+static int timeout = ADACOM_TIMEOUT;
+// Serial transport on a dedicated I/O thread
+static bool io_thread = false;
+static SerioParams serio_params = { .cpu = -1, .rt_priority = 0 };
+static bool serio_active = false;
+// Lines the I/O thread had to drop, as seen by the main loop
+static unsigned long serio_lost = 0;
+static Io serio_notify;
 // Adaura Infos
 static Str *model = NULL;
 static Str *sn = NULL;
@@ -44,18 +83,64 @@ static int num_channels = 0;
 // General values
 static double attenuations[ADACOM_MAX_CHANNELS];
 static int cur_channel;
+// Position of cur_channel in the send order of a set all
+static int cur_pos;
 static void *cmd_cb = NULL;
 // State CONNECTING
 static ConnectionStep conn_step = CONN_STEP_UNKNOWN;
+// The device infos of the connect are taken from a cache
+static bool conn_cached = false;
 static Regex *regex_channel = NULL;
 // State CONNECTED
 static CommandId cmd_id = COMMAND_UNKNOWN;
 static double req_attenuations[ADACOM_MAX_CHANNELS];
+static uint64_t req_times[ADACOM_MAX_CHANNELS];
+static adacom_applied_cb applied_cb = NULL;
+static adacom_state_cb state_change_cb = NULL;
 static Regex *regex_set_resp = NULL;
+// Background verification of the mirror
+static double verify_prev[ADACOM_MAX_CHANNELS];
+static double status_values[ADACOM_MAX_CHANNELS];
+static int verify_mismatches;
+static uint64_t last_activity = 0;
+// Set commands in flight without acknowledgement, oldest first
+static Unacked unacked[ADACOM_UNACKED_WINDOW];
+static int n_unacked = 0;
+// Replies of streamed commands which an acknowledged one has superseded
+static int stale_replies[ADACOM_MAX_CHANNELS];
+static int n_stale = 0;
+// Urgent set all which waits for the command on the wire
+static bool urgent_pending = false;
+static double urgent_values[ADACOM_MAX_CHANNELS];
+static adacom_channels_cb urgent_cb = NULL;
+// Members of a group are sent one after another (group -1: none)
+static int group_of[ADACOM_MAX_CHANNELS];
+static int send_order[ADACOM_MAX_CHANNELS];
+static int n_groups = 0;
+static int grp_count[ADACOM_MAX_CHANNELS];
+static uint64_t grp_first[ADACOM_MAX_CHANNELS];
+static uint64_t grp_last[ADACOM_MAX_CHANNELS];
+// Statistics
+static AdaComStats stats;
+static uint64_t cmd_start;
+// Reception time of the line which is processed
+static uint64_t rx_start;
+static uint64_t set_all_start;
+static double rtt_samples[RTT_SAMPLES];
+static int rtt_count = 0;
+static Hist cmd_hists[ADACOM_CMD_TYPES];
+static Hist channel_hists[ADACOM_MAX_CHANNELS];
+// Time between the first and the last confirmed member of a group in us
+static Hist skew_hists[ADACOM_MAX_CHANNELS];
+// Replay of a recorded wire trace
+static bool replaying = false;
+static Str *replay_last_cmd = NULL;
 
 // Forward declarations
 static void call_cmd_cb(AdaComError err);
+static void complete_cmd(AdaComError err);
 static void com_wdog_cb(MlTimer *timer, void *arg);
+static void start_urgent(void);
 
 
 void adacom_init(const char *com_device)
@@ -64,14 +149,22 @@ void adacom_init(const char *com_device)
     com_wdog = new(MlTimer, com_wdog_cb, NULL);
     regex_channel = new(Regex, "Channel\\s+([0-9]+):\\s+(.+)");
     regex_set_resp = new(Regex, "Channel\\s+([0-9]+).+set to\\s+(.+)");
+    for (int ch = 0; ch < ADACOM_MAX_CHANNELS; ch++) {
+        group_of[ch] = -1;
+        send_order[ch] = ch;
+    }
+    n_groups = 0;
     state = ADACOM_STATE_INITIALISED;
 }
 
 static void reset_adainfos(void)
 {
     delete(model);
+    model = NULL;
     delete(sn);
+    sn = NULL;
     delete(def_attenuations);
+    def_attenuations = NULL;
     num_channels = 0;
 }
 
@@ -120,6 +213,9 @@ static void change_state(AdaComState new_state)
     log_debug("adacom: %s ---> %s", state_to_cstr[state],
             state_to_cstr[new_state]);
     state = new_state;
+    if (state_change_cb != NULL) {
+        state_change_cb(state);
+    }
 }
 
 static bool is_cmd_running(void)
@@ -127,20 +223,98 @@ static bool is_cmd_running(void)
     return com_wdog != NULL ? com_wdog->pending : false;
 }
 
+// Normal requests also wait for a pending urgent one
+static bool is_lane_busy(void)
+{
+    return is_cmd_running() || urgent_pending;
+}
+
+bool adacom_is_busy(void)
+{
+    return is_lane_busy();
+}
+
 #define start_com_wdog(ms) mloop_timer_in(com_wdog, ms)
 #define stop_com_wdog() mloop_timer_cancle(com_wdog)
 
-static AdaComError send_cmd(const char *cmd)
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void record_rtt(AdaComCmdType type, int ch)
+{
+    uint64_t rtt_ns = rx_start - cmd_start;
+    stats.rtt_last = rtt_ns / 1000000.0;
+    rtt_samples[rtt_count++ % RTT_SAMPLES] = stats.rtt_last;
+    hist_record(&cmd_hists[type], rtt_ns / 1000);
+    if (ch >= 0 && ch < ADACOM_MAX_CHANNELS) {
+        hist_record(&channel_hists[ch], rtt_ns / 1000);
+    }
+}
+
+static bool write_cmd(AdaComCmdType type, const char *cmd)
+{
+    dlog_debug("adacom: [->] %s", cmd);
+    size_t size = strlen(cmd);
+    // Taken before the I/O thread is woken up, its reply may come first
+    last_activity = now_ns();
+    if (replaying) {
+        // Only remember the command to compare it with the trace
+        delete(replay_last_cmd);
+        replay_last_cmd = str_new_cstr(cmd);
+    } else {
+        if (serio_active) {
+            // The command ring of the I/O thread is full
+            if (!serio_write(cmd, size))
+                return false;
+        } else {
+            write(serial, cmd, size);
+        }
+        trace_record(TRACE_DIR_TX, cmd, size);
+    }
+    stats.cmds++;
+    if (type < ADACOM_CMD_TYPES) {
+        stats.type_cmds[type]++;
+    }
+    stats.bytes_tx += size;
+    return true;
+}
+
+static int cmd_timeout(AdaComCmdType type)
+{
+    // A (profiled) set timeout is too short for the multi-line replies of
+    // info and status (and for unknown raw commands).
+    if (type == ADACOM_CMD_SET || type == ADACOM_CMD_SET_ALL)
+        return timeout;
+    return timeout > ADACOM_TIMEOUT ? timeout : ADACOM_TIMEOUT;
+}
+
+static AdaComError send_cmd(AdaComCmdType type, const char *cmd)
 {
-    if (serial == NULL)
+    if (serial == NULL && !serio_active && !replaying)
         return ADACOM_ERR_DEVICE_NOT_AVAILABLE;
-    if (is_cmd_running())
+    if (is_cmd_running()) {
+        stats.busy++;
         return ADACOM_ERR_DEVICE_BUSY;
-    log_debug("adacom: [->] %s", cmd);
+    }
     // Send command
-    write(serial, cmd, strlen(cmd));
+    if (!write_cmd(type, cmd)) {
+        stats.busy++;
+        return ADACOM_ERR_DEVICE_BUSY;
+    }
+    cmd_start = last_activity;
     // Start communication watchdog timer
-    start_com_wdog(timeout);
+    start_com_wdog(cmd_timeout(type));
     return ADACOM_OK;
 }
 
@@ -156,19 +330,78 @@ static void call_cmd_cb(AdaComError err)
         } else if (cmd_id == COMMAND_SET_ALL) {
             adacom_channels_cb cb = (adacom_channels_cb)cmd_cb;
             cb(err, req_attenuations, num_channels);
+        } else if (cmd_id == COMMAND_STATUS) {
+            adacom_verify_cb cb = (adacom_verify_cb)cmd_cb;
+            cb(err, verify_prev, num_channels, verify_mismatches);
+        }
+    }
+}
+
+static void drop_unacked(int count)
+{
+    // The device answers in order, so unanswered older commands are lost
+    stats.unacked_lost += count;
+    n_unacked -= count;
+    memmove(unacked, unacked + count, n_unacked * sizeof(Unacked));
+}
+
+static void supersede_unacked(int ch)
+{
+    // An acknowledged command re-sends the channel, the replies of its
+    // streamed commands may still come in (or may have been lost).
+    int kept = 0;
+    for (int i = 0; i < n_unacked; i++) {
+        if (unacked[i].ch == ch) {
+            stale_replies[ch]++;
+            n_stale++;
+        } else {
+            unacked[kept++] = unacked[i];
         }
     }
+    n_unacked = kept;
+}
+
+static void expire_unacked(void)
+{
+    uint64_t limit = now_ns() - (uint64_t)timeout * 1000000;
+    int count = 0;
+    while (count < n_unacked && unacked[count].sent_ns < limit) {
+        count++;
+    }
+    drop_unacked(count);
+}
+
+static void finish_connect(void)
+{
+    stats.connects++;
+    change_state(ADACOM_STATE_CONNECTED);
+    complete_cmd(ADACOM_OK);
 }
 
 static void com_wdog_cb(MlTimer *timer, void *arg)
 {
+    if (state == ADACOM_STATE_CONNECTING
+            && conn_step == CONN_STEP_CHECK_STATUS) {
+        // No further channels, the cached infos match the device
+        finish_connect();
+        return;
+    }
+    stats.timeouts++;
+    drop_unacked(n_unacked);
     change_state(ADACOM_STATE_ERROR);
     call_cmd_cb(ADACOM_ERR_CMD_TIMEOUTED);
+    if (urgent_pending) {
+        urgent_pending = false;
+        if (urgent_cb != NULL) {
+            urgent_cb(ADACOM_ERR_CMD_TIMEOUTED, urgent_values, num_channels);
+        }
+    }
 }
 
 static void complete_cmd(AdaComError err) {
     // Stop the communication watchdog timer
     stop_com_wdog();
+    last_activity = now_ns();
     // Call callback of the specific command
     call_cmd_cb(err);
     // The user is allowed to send a new command in the callback function.
@@ -178,6 +411,9 @@ static void complete_cmd(AdaComError err) {
         cmd_id = COMMAND_NONE;
         cmd_cb = NULL;
     }
+    if (urgent_pending) {
+        start_urgent();
+    }
 }
 
 static void process_get_infos(Str *line)
@@ -202,12 +438,17 @@ static void process_get_infos(Str *line)
             if (model != NULL && sn != NULL && num_channels > 0) {
                 // Basic infos have been read
                 stop_com_wdog();
+                record_rtt(ADACOM_CMD_INFO, -1);
                 log_debug("adacom: Response from %O (%O) with %i channels.",
                         model, sn, num_channels);
                 // Now get current attenuations
-                send_cmd("status");
                 cur_channel = 1;
                 conn_step = CONN_STEP_GET_STATUS;
+                AdaComError err = send_cmd(ADACOM_CMD_STATUS, "status");
+                if (err != ADACOM_OK) {
+                    change_state(ADACOM_STATE_ERROR);
+                    complete_cmd(err);
+                }
             } else {
                 log_error("adacom: Missing information!");
                 change_state(ADACOM_STATE_ERROR);
@@ -228,7 +469,7 @@ static void process_get_status(Str *line)
     if (channel == NULL || value == NULL) {
         log_warn("adacom: Unable to parse channel value!");
     } else if (channel->val >= 1 && channel->val <= num_channels) {
-        log_debug("adacom: Got %.2fdB attenuation for channel %i",
+        dlog_debug("adacom: Got %.2fdB attenuation for channel %i",
                 value->val, channel->val);
         if (channel->val == cur_channel) {
             attenuations[channel->val - 1] = value->val;
@@ -238,9 +479,20 @@ static void process_get_status(Str *line)
         }
         // Check for completeness
         if (cur_channel > num_channels) {
-            change_state(ADACOM_STATE_CONNECTED);
-            complete_cmd(ADACOM_OK);
+            record_rtt(ADACOM_CMD_STATUS, -1);
+            if (conn_cached) {
+                conn_step = CONN_STEP_CHECK_STATUS;
+                start_com_wdog(STATUS_SETTLE_TIME);
+            } else {
+                finish_connect();
+            }
         }
+    } else if (conn_cached && channel->val > num_channels) {
+        // The device has more channels than the cache, i.e. it is another
+        log_warn("adacom: Channel %i beyond the cached number of channels!",
+                channel->val);
+        change_state(ADACOM_STATE_ERROR);
+        complete_cmd(ADACOM_ERR_NUM_CHANNELS);
     }
     delete(value);
     delete(channel);
@@ -251,7 +503,8 @@ static void process_connecting(Str *line)
 {
     if (conn_step == CONN_STEP_GET_INFOS) {
         process_get_infos(line);
-    } else if (conn_step == CONN_STEP_GET_STATUS) {
+    } else if (conn_step == CONN_STEP_GET_STATUS
+            || conn_step == CONN_STEP_CHECK_STATUS) {
         process_get_status(line);
     } else {
         log_error("adacom: Error in connection state machine!");
@@ -260,14 +513,56 @@ static void process_connecting(Str *line)
     }
 }
 
-static int skip_good_values(int channel)
+static bool is_good_value(int ch)
 {
-    int ch;
-    for (ch = channel; ch < num_channels; ch++) {
-        if (req_attenuations[ch] != attenuations[ch])
-            return ch;
+    if (req_attenuations[ch] != attenuations[ch])
+        return false;
+    // A streamed command in flight may still change the channel
+    for (int i = 0; i < n_unacked; i++) {
+        if (unacked[i].ch == ch && unacked[i].value != req_attenuations[ch])
+            return false;
+    }
+    return true;
+}
+
+static int skip_good_values(int pos)
+{
+    for (; pos < ADACOM_MAX_CHANNELS; pos++) {
+        int ch = send_order[pos];
+        if (ch < num_channels && !is_good_value(ch))
+            return pos;
+    }
+    return pos;
+}
+
+static bool is_group_open(int pos)
+{
+    // A group is open if further members are about to be sent
+    int g = group_of[send_order[pos]];
+    int next = skip_good_values(pos + 1);
+    return g >= 0 && next < ADACOM_MAX_CHANNELS
+            && group_of[send_order[next]] == g;
+}
+
+static void track_group_skew(int ch)
+{
+    int g = group_of[ch];
+    if (g < 0)
+        return;
+    if (grp_count[g]++ == 0) {
+        grp_first[g] = rx_start;
+    }
+    grp_last[g] = rx_start;
+}
+
+static void record_group_skew(void)
+{
+    for (int g = 0; g < n_groups; g++) {
+        if (grp_count[g] > 1) {
+            hist_record(&skew_hists[g], (grp_last[g] - grp_first[g]) / 1000);
+        }
+        grp_count[g] = 0;
     }
-    return ch;
 }
 
 
@@ -285,18 +580,40 @@ static void process_cmd_set(Str *line)
         } else {
             // Setting attenuation has been successful, stop watchdog timer
             stop_com_wdog();
+            record_rtt(ADACOM_CMD_SET, cur_channel);
             // Update mirror variable
             attenuations[channel->val - 1] = value->val;
+            if (applied_cb != NULL) {
+                applied_cb(cur_channel, value->val, req_times[cur_channel],
+                        realtime_ns());
+            }
             if (cmd_id == COMMAND_SET_ALL) {
+                track_group_skew(cur_channel);
+            }
+            if (cmd_id == COMMAND_SET_ALL && urgent_pending
+                    && !is_group_open(cur_pos)) {
+                // The remaining channels are left to the urgent request
+                record_group_skew();
+                complete_cmd(ADACOM_ERR_PREEMPTED);
+            } else if (cmd_id == COMMAND_SET_ALL) {
                 // Generate and send next command for set all command
-                cur_channel = skip_good_values(++cur_channel);
-                if (cur_channel < num_channels) {
+                cur_pos = skip_good_values(cur_pos + 1);
+                if (cur_pos < ADACOM_MAX_CHANNELS) {
+                    cur_channel = send_order[cur_pos];
+                    supersede_unacked(cur_channel);
                     Str cmd = init(Str, "set %i %.2f",
                             cur_channel + 1, req_attenuations[cur_channel]);
                     // Send command
-                    send_cmd(cmd.cstr);
+                    AdaComError err = send_cmd(ADACOM_CMD_SET_ALL, cmd.cstr);
                     destroy(&cmd);
+                    if (err != ADACOM_OK) {
+                        record_group_skew();
+                        complete_cmd(err);
+                    }
                 } else {
+                    hist_record(&cmd_hists[ADACOM_CMD_SET_ALL],
+                            (rx_start - set_all_start) / 1000);
+                    record_group_skew();
                     complete_cmd(ADACOM_OK);
                 }
             } else {
@@ -311,10 +628,48 @@ static void process_cmd_set(Str *line)
     }
 }
 
+static void process_cmd_status(Str *line)
+{
+    Array *match = regex_search(regex_channel, line->cstr);
+    if (match == NULL)
+        return;
+    Int *channel = str_to_int(array_get_at(match, 1), true);
+    Double *value = str_to_double(array_get_at(match, 2), true);
+    if (channel == NULL || value == NULL) {
+        log_warn("adacom: Unable to parse channel value!");
+    } else if (channel->val == cur_channel && cur_channel <= num_channels) {
+        status_values[cur_channel - 1] = value->val;
+        cur_channel++;
+    } else {
+        log_warn("adacom: Unexpected channel number!");
+    }
+    // Compare the complete status with the mirror
+    if (cur_channel > num_channels) {
+        record_rtt(ADACOM_CMD_STATUS, -1);
+        verify_mismatches = 0;
+        for (int ch = 0; ch < num_channels; ch++) {
+            verify_prev[ch] = attenuations[ch];
+            if (status_values[ch] != attenuations[ch]) {
+                attenuations[ch] = status_values[ch];
+                verify_mismatches++;
+            }
+        }
+        if (verify_mismatches > 0) {
+            stats.drifts++;
+        }
+        complete_cmd(ADACOM_OK);
+    }
+    delete(value);
+    delete(channel);
+    delete(match);
+}
+
 static void process_command(Str *line)
 {
     if (cmd_id == COMMAND_SET || cmd_id == COMMAND_SET_ALL) {
         process_cmd_set(line);
+    } else if (cmd_id == COMMAND_STATUS) {
+        process_cmd_status(line);
     } else if (is_cmd_running()) {
         log_warn("adacom: Got unexpectet reponse from device.");
     } else {
@@ -322,58 +677,323 @@ static void process_command(Str *line)
     }
 }
 
-static void serial_line_cb(MlIoPkg *self, void *data, size_t size, void *arg)
+static bool process_unacked(Str *line)
+{
+    Array *match = regex_search(regex_set_resp, line->cstr);
+    if (match == NULL)
+        return false;
+    bool handled = false;
+    Int *channel = str_to_int(array_get_at(match, 1), true);
+    Double *value = str_to_double(array_get_at(match, 2), true);
+    if (channel != NULL && value != NULL) {
+        int ch = channel->val - 1;
+        // The entries of the running command's channel have been superseded
+        // when it was sent, so a match is always a streamed reply.
+        for (int i = 0; i < n_unacked; i++) {
+            if (unacked[i].ch != ch || unacked[i].value != value->val)
+                continue;
+            drop_unacked(i);
+            attenuations[ch] = value->val;
+            if (applied_cb != NULL) {
+                applied_cb(ch, value->val, unacked[0].req_ns,
+                        realtime_ns());
+            }
+            n_unacked--;
+            memmove(unacked, unacked + 1, n_unacked * sizeof(Unacked));
+            handled = true;
+            break;
+        }
+        bool ack = !handled
+                && (cmd_id == COMMAND_SET || cmd_id == COMMAND_SET_ALL)
+                && is_cmd_running() && ch == cur_channel
+                && value->val == req_attenuations[cur_channel];
+        if (ack) {
+            // Answer of the acknowledged command, which was sent after all
+            // unacknowledged ones. A superseded reply with the same value
+            // confirms the same, its successor is then taken as stale.
+            drop_unacked(n_unacked);
+        } else if (!handled && ch >= 0 && ch < ADACOM_MAX_CHANNELS
+                && stale_replies[ch] > 0) {
+            dlog_debug("adacom: Ignoring superseded reply of channel %i.",
+                    ch + 1);
+            stale_replies[ch]--;
+            n_stale--;
+            handled = true;
+        }
+    }
+    delete(value);
+    delete(channel);
+    delete(match);
+    return handled;
+}
+
+static void process_line(void *data, size_t size, uint64_t ts_ns)
 {
     Str line;
+    rx_start = ts_ns;
+    stats.bytes_rx += size;
+    if (!replaying) {
+        trace_record(TRACE_DIR_RX, data, size);
+    }
     str_init_ncopy(&line, data, size);
     str_strip(&line);
     if (str_len(&line) > 0 
             && !str_startswith(&line, "--")
             && !str_startswith(&line, "#")) {
-        log_debug("adacom: [<-] %s", line.cstr);
+        dlog_debug("adacom: [<-] %s", line.cstr);
         if (state == ADACOM_STATE_CONNECTING) {
             process_connecting(&line);
         } else if (state == ADACOM_STATE_CONNECTED) {
-            process_command(&line);
+            if ((n_unacked == 0 && n_stale == 0)
+                    || !process_unacked(&line)) {
+                process_command(&line);
+            }
         }
     }
     destroy(&line);
 }
 
+static void serial_line_cb(MlIoPkg *self, void *data, size_t size, void *arg)
+{
+    process_line(data, size, now_ns());
+}
+
 static void serial_eof_cb(MlIoReader *self, void *arg)
 {
     log_error("adacom: Received EOF from serial device!");
     adacom_disconnect();
 }
 
-AdaComError adacom_connect(adacom_connect_cb state_cb)
+static void serio_notify_cb(MlIo *self, int fd, ml_io_flag_t events, void *arg)
 {
-    serial = new(Serial, device, SERIAL_SPEED_B115200, SERIAL_PARITY_NONE);
-    if (!is_open(serial)) {
-        log_error("adacom: Unable to connect to serial '%s'!", device);
-        change_state(ADACOM_STATE_ERROR);
-        serial_delete(serial);
-        serial = NULL;
-        return ADACOM_ERR_DEVICE_NOT_FOUND;
+    if (!(events & ML_IO_READ))
+        return;
+    eventfd_t count;
+    eventfd_read(fd, &count);
+    SerioEvent event;
+    // Processing a line might disconnect the device
+    while (serio_active && serio_next(&event)) {
+        if (event.type == SERIO_EVT_EOF) {
+            serial_eof_cb(NULL, NULL);
+            break;
+        }
+        // The reception time is taken on the I/O thread
+        process_line(event.data, event.len, event.ts_ns);
+    }
+    unsigned long lost = serio_dropped();
+    if (serio_active && lost != serio_lost) {
+        // The reply of the running command might be lost
+        log_error("adacom: %lu line(s) dropped by the I/O thread!",
+                lost - serio_lost);
+        serio_lost = lost;
+        drop_unacked(n_unacked);
+        if (is_cmd_running()) {
+            complete_cmd(ADACOM_ERR_UNKONWN);
+        }
+    }
+}
+
+static bool open_serio(void)
+{
+    int fd = serio_open(device, &serio_params);
+    if (fd < 0)
+        return false;
+    if (serio_sched_error() != NULL) {
+        log_warn("adacom: I/O thread: %s!", serio_sched_error());
+    }
+    serio_lost = serio_dropped();
+    serio_notify = init(Io, fd);
+    mloop_io_new(&serio_notify, ML_IO_READ, serio_notify_cb, NULL);
+    serio_active = true;
+    return true;
+}
+
+static AdaComError open_serial(adacom_connect_cb state_cb)
+{
+    if (io_thread) {
+        if (!open_serio()) {
+            log_error("adacom: Unable to connect to serial '%s'!", device);
+            change_state(ADACOM_STATE_ERROR);
+            return ADACOM_ERR_DEVICE_NOT_FOUND;
+        }
+    } else {
+        serial = new(Serial, device, SERIAL_SPEED_B115200, SERIAL_PARITY_NONE);
+        if (!is_open(serial)) {
+            log_error("adacom: Unable to connect to serial '%s'!", device);
+            change_state(ADACOM_STATE_ERROR);
+            serial_delete(serial);
+            serial = NULL;
+            return ADACOM_ERR_DEVICE_NOT_FOUND;
+        }
+        mloop_io_pkg_new(serial, '\n', serial_line_cb, serial_eof_cb, NULL);
     }
     change_state(ADACOM_STATE_CONNECTING);
     reset_adainfos();
     cmd_cb = state_cb;
     cmd_id = COMMAND_NONE;
-    mloop_io_pkg_new(serial, '\n', serial_line_cb, serial_eof_cb, NULL);
-    conn_step = CONN_STEP_GET_INFOS;
-    send_cmd("info");
     return ADACOM_OK;
 }
 
+AdaComError adacom_connect(adacom_connect_cb state_cb)
+{
+    AdaComError err = open_serial(state_cb);
+    if (err != ADACOM_OK)
+        return err;
+    conn_cached = false;
+    conn_step = CONN_STEP_GET_INFOS;
+    err = send_cmd(ADACOM_CMD_INFO, "info");
+    if (err != ADACOM_OK) {
+        adacom_disconnect();
+    }
+    return err;
+}
+
+AdaComError adacom_connect_cached(const char *cached_model,
+        const char *cached_sn, int n, adacom_connect_cb state_cb)
+{
+    if (n <= 0 || n > ADACOM_MAX_CHANNELS)
+        return ADACOM_ERR_NUM_CHANNELS;
+    AdaComError err = open_serial(state_cb);
+    if (err != ADACOM_OK)
+        return err;
+    // Skip the info command and only read the current attenuations
+    model = str_new_cstr(cached_model);
+    sn = str_new_cstr(cached_sn);
+    num_channels = n;
+    conn_cached = true;
+    conn_step = CONN_STEP_GET_STATUS;
+    cur_channel = 1;
+    err = send_cmd(ADACOM_CMD_STATUS, "status");
+    if (err != ADACOM_OK) {
+        adacom_disconnect();
+    }
+    return err;
+}
+
 void adacom_disconnect(void)
 {
-    if (serial == NULL || state != ADACOM_STATE_CONNECTED)
+    if (serial == NULL && !serio_active)
         return;
-    serial_close(serial);
-    serial_delete(serial);
-    serial = NULL;
+    bool running = is_cmd_running();
+    stop_com_wdog();
+    n_unacked = 0;
+    memset(stale_replies, 0, sizeof(stale_replies));
+    n_stale = 0;
+    if (serio_active) {
+        serio_active = false;
+        serio_close();
+        destroy(&serio_notify);
+    } else {
+        serial_close(serial);
+        serial_delete(serial);
+        serial = NULL;
+    }
+    change_state(ADACOM_STATE_DISCONNECTED);
+    // Nothing answers the commands anymore, the requesters learn it here
+    bool urgent = urgent_pending;
+    urgent_pending = false;
+    if (running) {
+        call_cmd_cb(ADACOM_ERR_NOT_CONNECTED);
+    }
+    // The callback is allowed to connect again
+    if (!is_cmd_running()) {
+        cmd_id = COMMAND_NONE;
+        cmd_cb = NULL;
+    }
+    if (urgent && urgent_cb != NULL) {
+        urgent_cb(ADACOM_ERR_NOT_CONNECTED, urgent_values, num_channels);
+    }
+}
+
+void adacom_set_io_thread(bool enable, int cpu, int rt_priority)
+{
+    io_thread = enable;
+    serio_params.cpu = cpu;
+    serio_params.rt_priority = rt_priority;
+}
+
+void adacom_set_timeout(int ms)
+{
+    timeout = ms > 0 ? ms : ADACOM_TIMEOUT;
+}
+
+int adacom_timeout(void)
+{
+    return timeout;
+}
+
+void adacom_set_applied_cb(adacom_applied_cb cb)
+{
+    applied_cb = cb;
+}
+
+void adacom_set_state_cb(adacom_state_cb cb)
+{
+    state_change_cb = cb;
+}
+
+static bool replay_tx(const char *cmd)
+{
+    if (is_cmd_running()) {
+        // The command has been generated by adacom itself (e.g. status)
+        return replay_last_cmd != NULL && str_eq_cstr(replay_last_cmd, cmd);
+    }
+    // Issue the recorded command the same way the user of adacom did
+    int ch;
+    double value;
+    if (sscanf(cmd, "set %i %lf", &ch, &value) == 2) {
+        return adacom_set_channel(ch - 1, value, NULL) == ADACOM_OK;
+    }
+    // Raw commands are only counted in the total
+    return send_cmd(ADACOM_CMD_TYPES, cmd) == ADACOM_OK;
+}
+
+AdaComError adacom_replay(const char *trace_path, adacom_connect_cb state_cb)
+{
+    TraceReader reader;
+    if (!trace_reader_open(&reader, trace_path)) {
+        log_error("adacom: Unable to open trace '%s'!", trace_path);
+        return ADACOM_ERR_DEVICE_NOT_FOUND;
+    }
+    // Behave like adacom_connect, but without a serial device
+    replaying = true;
+    change_state(ADACOM_STATE_CONNECTING);
+    reset_adainfos();
+    cmd_cb = state_cb;
+    cmd_id = COMMAND_NONE;
+    conn_cached = false;
+    conn_step = CONN_STEP_GET_INFOS;
+    unsigned long n_tx = 0, n_rx = 0, n_mismatch = 0;
+    uint64_t t_first = 0;
+    uint64_t t_start = now_ns();
+    while (trace_reader_next(&reader)) {
+        if (n_tx + n_rx == 0) {
+            t_first = reader.rec.ts_ns;
+        }
+        double t_rel = (reader.rec.ts_ns - t_first) / 1000000.0;
+        if (reader.rec.dir == TRACE_DIR_TX) {
+            n_tx++;
+            log_debug("adacom: replay +%.3f ms [->] %s", t_rel, reader.data);
+            if (!replay_tx(reader.data)) {
+                log_warn("adacom: Replay mismatch for '%s'!", reader.data);
+                n_mismatch++;
+            }
+        } else {
+            n_rx++;
+            log_debug("adacom: replay +%.3f ms [<-]", t_rel);
+            process_line(reader.data, reader.rec.len, now_ns());
+        }
+    }
+    double duration = (now_ns() - t_start) / 1000000.0;
+    trace_reader_close(&reader);
+    stop_com_wdog();
+    delete(replay_last_cmd);
+    replay_last_cmd = NULL;
+    replaying = false;
     change_state(ADACOM_STATE_DISCONNECTED);
+    log_info("adacom: Replayed %lu commands and %lu replies in %.3f ms "
+            "(%lu mismatches).", n_tx, n_rx, duration, n_mismatch);
+    return n_mismatch == 0 ? ADACOM_OK : ADACOM_ERR_UNKONWN;
 }
 
 double adacom_get_channel(int ch)
@@ -396,22 +1016,53 @@ static double validate_attenuation(double value)
     return a_int + ivals * ADACOM_MIN_INTERVAL;
 }
 
+AdaComError adacom_verify(adacom_verify_cb verify_cb)
+{
+    if (state != ADACOM_STATE_CONNECTED)
+        return ADACOM_ERR_NOT_CONNECTED;
+    if (is_lane_busy()) {
+        stats.busy++;
+        return ADACOM_ERR_DEVICE_BUSY;
+    }
+    // Read back all attenuations, they are compared when complete
+    cur_channel = 1;
+    cmd_id = COMMAND_STATUS;
+    cmd_cb = verify_cb;
+    return send_cmd(ADACOM_CMD_STATUS, "status");
+}
+
+int adacom_idle_time(void)
+{
+    // Replies which did not come in time are lost, not outstanding
+    expire_unacked();
+    if (is_cmd_running() || n_unacked > 0)
+        return 0;
+    return (now_ns() - last_activity) / 1000000;
+}
+
 AdaComError adacom_set_channel(int ch, double value, adacom_channel_cb ch_cb)
 {
     if (state != ADACOM_STATE_CONNECTED)
         return ADACOM_ERR_NOT_CONNECTED;
     if (ch < 0 || ch > num_channels)
         return ADACOM_ERR_INVALID_CHANNEL;
+    // Do not touch the variables of a command which is still in flight
+    if (is_lane_busy()) {
+        stats.busy++;
+        return ADACOM_ERR_DEVICE_BUSY;
+    }
     // Save channel number and requested value
     cur_channel = ch;
     req_attenuations[cur_channel] = validate_attenuation(value);
+    req_times[cur_channel] = realtime_ns();
+    supersede_unacked(cur_channel);
     // Generate command
     Str cmd = init(Str, "set %i %.2f",
             cur_channel + 1, req_attenuations[cur_channel]);
     // Send command
     cmd_id = COMMAND_SET;
     cmd_cb = ch_cb;
-    AdaComError err = send_cmd(cmd.cstr);
+    AdaComError err = send_cmd(ADACOM_CMD_SET, cmd.cstr);
     destroy(&cmd);
     return err;
 }
@@ -428,28 +1079,272 @@ AdaComError adacom_get_all(double *values, int n)
     return ADACOM_OK;
 }
 
-AdaComError adacom_set_all(double *values, int n, adacom_channels_cb chs_cb)
+AdaComError adacom_get_target(double *values, int n)
+{
+    AdaComError err = adacom_get_all(values, n);
+    if (err != ADACOM_OK)
+        return err;
+    expire_unacked();
+    for (int i = 0; i < n_unacked; i++) {
+        values[unacked[i].ch] = unacked[i].value;
+    }
+    if (!is_cmd_running())
+        return ADACOM_OK;
+    // Include the values of the command which is in flight
+    if (cmd_id == COMMAND_SET) {
+        values[cur_channel] = req_attenuations[cur_channel];
+    } else if (cmd_id == COMMAND_SET_ALL) {
+        for (int pos = cur_pos; pos < ADACOM_MAX_CHANNELS; pos++) {
+            if (send_order[pos] < n) {
+                values[send_order[pos]] = req_attenuations[send_order[pos]];
+            }
+        }
+    }
+    return ADACOM_OK;
+}
+
+static AdaComError start_set_all(double *values, int n,
+        adacom_channels_cb chs_cb)
 {
-    if (state != ADACOM_STATE_CONNECTED)
-        return ADACOM_ERR_NOT_CONNECTED;
-    if (n != num_channels)
-        return ADACOM_ERR_NUM_CHANNELS;
     // Start with the first channel and save requested values
+    uint64_t req_time = realtime_ns();
     for (int ch = 0; ch < n; ch++) {
         req_attenuations[ch] = validate_attenuation(values[ch]);
+        req_times[ch] = req_time;
     }
-    cur_channel = skip_good_values(0);
-    if (cur_channel >= num_channels) {
+    cur_pos = skip_good_values(0);
+    if (cur_pos >= ADACOM_MAX_CHANNELS) {
         log_debug("adacom: Channels are already set to requested values.");
         return ADACOM_OK;
     }
+    cur_channel = send_order[cur_pos];
+    supersede_unacked(cur_channel);
+    for (int g = 0; g < n_groups; g++) {
+        grp_count[g] = 0;
+    }
     // Generate command for the first channel
     Str cmd = init(Str, "set %i %.2f",
             cur_channel + 1, req_attenuations[cur_channel]);
     // Send command
     cmd_id = COMMAND_SET_ALL;
     cmd_cb = chs_cb;
-    send_cmd(cmd.cstr);
+    AdaComError err = send_cmd(ADACOM_CMD_SET_ALL, cmd.cstr);
+    set_all_start = cmd_start;
     destroy(&cmd);
+    return err;
+}
+
+static void start_urgent(void)
+{
+    urgent_pending = false;
+    AdaComError err = start_set_all(urgent_values, num_channels, urgent_cb);
+    // Without a command on the wire the requester learns the result here
+    if ((err != ADACOM_OK || !is_cmd_running()) && urgent_cb != NULL) {
+        urgent_cb(err, urgent_values, num_channels);
+    }
+}
+
+AdaComError adacom_set_all_prio(double *values, int n, AdaComPriority prio,
+        adacom_channels_cb chs_cb)
+{
+    if (state != ADACOM_STATE_CONNECTED)
+        return ADACOM_ERR_NOT_CONNECTED;
+    if (n != num_channels)
+        return ADACOM_ERR_NUM_CHANNELS;
+    if (prio == ADACOM_PRIO_URGENT) {
+        for (int ch = 0; ch < n; ch++) {
+            urgent_values[ch] = validate_attenuation(values[ch]);
+        }
+        urgent_cb = chs_cb;
+        if (!is_cmd_running())
+            return start_set_all(urgent_values, n, chs_cb);
+        // The command on the wire cannot be recalled, the rest of its work
+        // is cancelled and the urgent one goes next.
+        log_info("adacom: Urgent request preempts the running command.");
+        stats.preemptions++;
+        urgent_pending = true;
+        return ADACOM_OK;
+    }
+    // Do not touch the variables of a command which is still in flight
+    if (is_lane_busy()) {
+        stats.busy++;
+        return ADACOM_ERR_DEVICE_BUSY;
+    }
+    return start_set_all(values, n, chs_cb);
+}
+
+AdaComError adacom_set_all(double *values, int n, adacom_channels_cb chs_cb)
+{
+    return adacom_set_all_prio(values, n, ADACOM_PRIO_NORMAL, chs_cb);
+}
+
+AdaComError adacom_set_all_unacked(double *values, int n)
+{
+    if (state != ADACOM_STATE_CONNECTED)
+        return ADACOM_ERR_NOT_CONNECTED;
+    if (n != num_channels)
+        return ADACOM_ERR_NUM_CHANNELS;
+    // Acknowledged commands keep the link, their replies have to be matched
+    if (is_lane_busy()) {
+        stats.busy++;
+        return ADACOM_ERR_DEVICE_BUSY;
+    }
+    expire_unacked();
+    double target[n];
+    adacom_get_target(target, n);
+    int changes = 0;
+    for (int ch = 0; ch < n; ch++) {
+        values[ch] = validate_attenuation(values[ch]);
+        if (values[ch] != target[ch]) {
+            changes++;
+        }
+    }
+    if (changes == 0)
+        return ADACOM_OK;
+    // Do not overrun the input buffer of the device
+    if (n_unacked + changes > ADACOM_UNACKED_WINDOW) {
+        stats.busy++;
+        return ADACOM_ERR_DEVICE_BUSY;
+    }
+    uint64_t req_time = realtime_ns();
+    for (int pos = 0; pos < ADACOM_MAX_CHANNELS; pos++) {
+        int ch = send_order[pos];
+        if (ch >= n || values[ch] == target[ch])
+            continue;
+        Str cmd = init(Str, "set %i %.2f", ch + 1, values[ch]);
+        bool written = write_cmd(ADACOM_CMD_SET, cmd.cstr);
+        destroy(&cmd);
+        if (!written) {
+            // The channels which are sent already stay tracked
+            stats.busy++;
+            return ADACOM_ERR_DEVICE_BUSY;
+        }
+        unacked[n_unacked++] = (Unacked){
+            .ch = ch, .value = values[ch], .req_ns = req_time,
+            .sent_ns = last_activity
+        };
+        stats.unacked++;
+    }
     return ADACOM_OK;
 }
+
+static int cmp_double(const void *a, const void *b)
+{
+    double diff = *(const double *)a - *(const double *)b;
+    return diff < 0 ? -1 : diff > 0;
+}
+
+void adacom_get_stats(AdaComStats *s)
+{
+    *s = stats;
+    int n = rtt_count < RTT_SAMPLES ? rtt_count : RTT_SAMPLES;
+    if (n == 0)
+        return;
+    double samples[n];
+    memcpy(samples, rtt_samples, n * sizeof(double));
+    qsort(samples, n, sizeof(double), cmp_double);
+    s->rtt_p50 = samples[n / 2];
+    s->rtt_p99 = samples[(n * 99) / 100];
+}
+
+const Hist *adacom_cmd_hist(AdaComCmdType type)
+{
+    if (type < 0 || type >= ADACOM_CMD_TYPES)
+        return NULL;
+    return &cmd_hists[type];
+}
+
+const Hist *adacom_channel_hist(int ch)
+{
+    if (ch < 0 || ch >= ADACOM_MAX_CHANNELS)
+        return NULL;
+    return &channel_hists[ch];
+}
+
+const char *adacom_cmd_type_to_cstr(AdaComCmdType type)
+{
+    if (type < 0 || type >= ADACOM_CMD_TYPES) {
+        return "INVALID_TYPE";
+    }
+    return cmd_type_to_cstr[type];
+}
+
+static void dump_hist(FILE *stream, const char *name, const Hist *h)
+{
+    if (h->count == 0)
+        return;
+    fprintf(stream, "  %-8s %6lu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n", name,
+            (unsigned long)h->count, h->min / 1000.0, hist_mean(h) / 1000.0,
+            hist_percentile(h, 50) / 1000.0, hist_percentile(h, 90) / 1000.0,
+            hist_percentile(h, 99) / 1000.0, h->max / 1000.0);
+}
+
+void adacom_dump_hists(FILE *stream)
+{
+    fprintf(stream, "Command latencies [ms]:\n");
+    fprintf(stream, "  %-8s %6s %9s %9s %9s %9s %9s %9s\n", "", "count", "min",
+            "mean", "p50", "p90", "p99", "max");
+    for (int type = 0; type < ADACOM_CMD_TYPES; type++) {
+        dump_hist(stream, cmd_type_to_cstr[type], &cmd_hists[type]);
+    }
+    for (int ch = 0; ch < ADACOM_MAX_CHANNELS; ch++) {
+        char name[8];
+        snprintf(name, sizeof(name), "CH%02i", ch + 1);
+        dump_hist(stream, name, &channel_hists[ch]);
+    }
+    for (int g = 0; g < n_groups; g++) {
+        if (g == 0) {
+            fprintf(stream, "Group skew [ms]:\n");
+        }
+        char name[12];
+        snprintf(name, sizeof(name), "G%02i", g + 1);
+        dump_hist(stream, name, &skew_hists[g]);
+    }
+}
+
+void adacom_group_order(const int *groups, int n, int *order)
+{
+    // Every channel is followed by the other members of its group
+    bool placed[n];
+    memset(placed, 0, sizeof(placed));
+    int pos = 0;
+    for (int ch = 0; ch < n; ch++) {
+        if (placed[ch])
+            continue;
+        order[pos++] = ch;
+        placed[ch] = true;
+        if (groups[ch] < 0)
+            continue;
+        for (int m = ch + 1; m < n; m++) {
+            if (!placed[m] && groups[m] == groups[ch]) {
+                order[pos++] = m;
+                placed[m] = true;
+            }
+        }
+    }
+}
+
+void adacom_set_groups(const int *groups, int n)
+{
+    n_groups = 0;
+    for (int ch = 0; ch < ADACOM_MAX_CHANNELS; ch++) {
+        group_of[ch] = ch < n ? groups[ch] : -1;
+        if (group_of[ch] >= n_groups) {
+            n_groups = group_of[ch] + 1;
+        }
+        hist_reset(&skew_hists[ch]);
+    }
+    adacom_group_order(group_of, ADACOM_MAX_CHANNELS, send_order);
+}
+
+int adacom_num_groups(void)
+{
+    return n_groups;
+}
+
+const Hist *adacom_group_skew_hist(int group)
+{
+    if (group < 0 || group >= n_groups)
+        return NULL;
+    return &skew_hists[group];
+}
@@ -2,11 +2,20 @@
 #define _ADACOM_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hist.h"
 
 #define ADACOM_MAX_CHANNELS 16
 #define ADACOM_MIN_ATTENUATION 0
 #define ADACOM_MAX_ATTENUATION 95
 #define ADACOM_MIN_INTERVAL 0.25
+#define ADACOM_BAUDRATE 115200
+// Default time in ms to wait for the answer of a command
+#define ADACOM_TIMEOUT 1000
+// Maximal number of unacknowledged set commands in flight
+#define ADACOM_UNACKED_WINDOW 4
 
 
 typedef enum {
@@ -29,12 +38,60 @@ typedef enum {
     ADACOM_ERR_INVALID_ATTENUATION,
     ADACOM_ERR_NUM_CHANNELS,
     ADACOM_ERR_CMD_TIMEOUTED,
+    // The rest of the command has been cancelled by an urgent one
+    ADACOM_ERR_PREEMPTED,
     ADACOM_ERR_UNKONWN
 } AdaComError;
 
+typedef enum {
+    ADACOM_CMD_INFO,
+    ADACOM_CMD_STATUS,
+    ADACOM_CMD_SET,
+    ADACOM_CMD_SET_ALL,
+    ADACOM_CMD_TYPES
+} AdaComCmdType;
+
+typedef enum {
+    ADACOM_PRIO_NORMAL,
+    // Cancels the remaining work of the running command and goes next
+    ADACOM_PRIO_URGENT
+} AdaComPriority;
+
+typedef struct {
+    unsigned long cmds;
+    // Sent commands per type, the set commands of a set all are counted as
+    // ADACOM_CMD_SET_ALL and raw commands only in cmds
+    unsigned long type_cmds[ADACOM_CMD_TYPES];
+    unsigned long timeouts;
+    // Successful connects, i.e. one more than the number of reconnects
+    unsigned long connects;
+    unsigned long busy;
+    unsigned long preemptions;
+    // Verifications which found attenuations changed outside of adacom
+    unsigned long drifts;
+    // Unacknowledged set commands and the ones without a reply
+    unsigned long unacked;
+    unsigned long unacked_lost;
+    unsigned long bytes_tx;
+    unsigned long bytes_rx;
+    // Round trip times of the recent commands in milliseconds
+    double rtt_last;
+    double rtt_p50;
+    double rtt_p99;
+} AdaComStats;
+
 typedef void (*adacom_connect_cb)(AdaComError err);
 typedef void (*adacom_channel_cb)(AdaComError err, int ch, double value);
 typedef void (*adacom_channels_cb)(AdaComError err, double *values, int n);
+// Called with the mirror values before the verification and the number of
+// channels which differed (the mirror then holds the device values)
+typedef void (*adacom_verify_cb)(AdaComError err, const double *previous,
+        int n, int mismatches);
+// Called for every attenuation the device has confirmed (CLOCK_REALTIME ns)
+typedef void (*adacom_applied_cb)(int ch, double value, uint64_t req_ns,
+        uint64_t applied_ns);
+// Called for every change of the connection state (e.g. a lost link)
+typedef void (*adacom_state_cb)(AdaComState state);
 
 
 void adacom_init(const char *com_device);
@@ -46,13 +103,53 @@ const char *adacom_state_to_cstr(AdaComState state);
 const char *adacom_model(void);
 const char *adacom_sn(void);
 int adacom_num_channels(void);
+bool adacom_is_busy(void);
 
 AdaComError adacom_connect(adacom_connect_cb state_cb);
+AdaComError adacom_connect_cached(const char *model, const char *sn, int n,
+        adacom_connect_cb state_cb);
 void adacom_disconnect(void);
+// Use a dedicated I/O thread (cpu < 0: no pinning, rt_priority 0: normal)
+void adacom_set_io_thread(bool enable, int cpu, int rt_priority);
 
 double adacom_get_channel(int ch);
 AdaComError adacom_set_channel(int ch, double value, adacom_channel_cb ch_cb);
 AdaComError adacom_get_all(double *values, int n);
+AdaComError adacom_get_target(double *values, int n);
 AdaComError adacom_set_all(double *values, int n, adacom_channels_cb chs_cb);
+// An urgent request is accepted while busy and replaces a pending urgent
+// one. The preempted command is completed with ADACOM_ERR_PREEMPTED.
+AdaComError adacom_set_all_prio(double *values, int n, AdaComPriority prio,
+        adacom_channels_cb chs_cb);
+// Streams the changed channels without waiting for the replies, which are
+// matched as they come in. Replies may get lost, so verify the final value
+// with an acknowledged command. values are validated in place.
+AdaComError adacom_set_all_unacked(double *values, int n);
+AdaComError adacom_verify(adacom_verify_cb verify_cb);
+// Time in ms since the device answered the last command (0 while busy)
+int adacom_idle_time(void);
+
+void adacom_set_applied_cb(adacom_applied_cb cb);
+void adacom_set_state_cb(adacom_state_cb cb);
+// Timeout of set commands, info and status keep at least ADACOM_TIMEOUT
+void adacom_set_timeout(int ms);
+int adacom_timeout(void);
+
+AdaComError adacom_replay(const char *trace_path, adacom_connect_cb state_cb);
+
+void adacom_get_stats(AdaComStats *stats);
+// Latency histograms in microseconds
+const Hist *adacom_cmd_hist(AdaComCmdType type);
+const Hist *adacom_channel_hist(int ch);
+const char *adacom_cmd_type_to_cstr(AdaComCmdType type);
+
+// Send order of a set all in which the channels of a group (0, 1, ... or -1
+// for none) are consecutive, i.e. no other command comes between members.
+void adacom_group_order(const int *groups, int n, int *order);
+void adacom_set_groups(const int *groups, int n);
+int adacom_num_groups(void);
+// Time between the first and the last confirmed member in microseconds
+const Hist *adacom_group_skew_hist(int group);
+void adacom_dump_hists(FILE *stream);
 
 #endif /* _ADACOM_H_ */
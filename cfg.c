@@ -8,6 +8,7 @@
 /* Default Configuration */
 Config cfg = {
     .log_level = LOG_INFO,
+    .lazy_debug_log = false,
     .file_path = NULL,
     .ada.device = "/dev/ttyUSB_ADAURA",
     .groups = NULL,
@@ -17,10 +18,45 @@ Config cfg = {
     .pivot_attenuation = 47.5,
     .sample_rate = 10,
     .action_time = 1000,
-    .recovery_time = 5000
+    .recovery_time = 5000,
+    .dispatch_lead = -1,
+    .control_socket = NULL,
+    .event_socket = NULL,
+    .shm_path = NULL,
+    .journal_file = NULL,
+    .trace_file = NULL,
+    .replay_file = NULL,
+    .playback_file = NULL,
+    .playback_channels = NULL,
+    .mobility = {
+        .params = {
+            .pl_ref = 40,
+            .pl_exp = 3,
+            .pl_d0 = 1,
+            .pl_offset = 0,
+            .speed = 1,
+            .loops = 1
+        },
+        .n_aps = 0,
+        .n_waypoints = 0
+    },
+    .fading = { .seed = 1, .sigma = 0, .correlation_time = 2000 },
+    .simulation = { .duration = 0, .channels = 8, .cmd_latency = 2.0 },
+    .io_thread = { .enabled = false, .cpu = -1, .rt_priority = 0 },
+    .verify = { .interval = 10000, .idle = 1000, .repush = false },
+    .unacked = { .enabled = false, .checkpoint = 10 },
+    .metrics = { .file = NULL, .interval = 15000, .port = 0 },
+    .cmd = { .name = NULL, .argc = 0, .argv = NULL },
+    .presets = NULL,
+    .cache_file = NULL,
+    .profile_dir = NULL
 };
 
 static const char *cfg_file_paths[] = { "~/.adacon.json", "/etc/adacon.json" };
+static const char *cache_file_path = "~/.cache/adacon.json";
+static const char *profile_dir_path = "~/.cache/adacon-profiles";
+static const char *commands[] = { "set", "get", "preset", "plan",
+                                   "characterise" };
 static const char *prog_name = NULL;
 static Map *cmdline_args = NULL;
 
@@ -38,6 +74,17 @@ static void *log_level_check(Str *log_level_str, Str **err_msg)
     return log_level;
 }
 
+static void *duration_check(Str *duration_str, Str **err_msg)
+{
+    Int *duration = argparse_int(duration_str, err_msg);
+    if (duration != NULL && int_get(duration) <= 0) {
+        *err_msg = str_new("invalid duration: %O!", duration_str);
+        delete(duration);
+        duration = NULL;
+    }
+    return duration;
+}
+
 static void *config_file_check(Str *path, Str **err_msg)
 {
     Json *js = NULL;
@@ -69,6 +116,44 @@ static void *device_check(Str *path, Str **err_msg)
     return new_copy(path);
 }
 
+static void *path_check(Str *path, Str **err_msg)
+{
+    return new_copy(path);
+}
+
+static void *file_check(Str *path, Str **err_msg)
+{
+    if (!path_is_file(str_cstr(path)))
+    {
+        *err_msg = str_new("file '%O' does not exist!", path);
+        return NULL;
+    }
+    return new_copy(path);
+}
+
+static int split_command(int argc, char *argv[])
+{
+    if (argc < 2)
+        return argc;
+    for (int i = 0; i < ARRAY_LEN(commands); i++) {
+        if (strcmp(argv[1], commands[i]) != 0)
+            continue;
+        // The arguments of the command reach up to the first option ...
+        int n = 0;
+        while (2 + n < argc && argv[2 + n][0] != '-') {
+            n++;
+        }
+        cfg.cmd.name = argv[1];
+        cfg.cmd.argc = n;
+        cfg.cmd.argv = malloc(n * sizeof(char *));
+        memcpy(cfg.cmd.argv, argv + 2, n * sizeof(char *));
+        // ... and the options are left for the argument parser.
+        memmove(argv + 1, argv + 2 + n, (argc - 2 - n) * sizeof(char *));
+        return argc - 1 - n;
+    }
+    return argc;
+}
+
 static Map *parse_cmdline_args(int argc, char *argv[])
 {
     Map *args;
@@ -84,6 +169,29 @@ static Map *parse_cmdline_args(int argc, char *argv[])
     // * Device name
     argparse_add_opt(ap, 'd', "device", "DEV", "1", device_check,
                      "path to serial device");
+    // * Control socket
+    argparse_add_opt(ap, 's', "socket", "PATH", "1", path_check,
+                     "path of the control socket");
+    // * Event socket
+    argparse_add_opt(ap, 'e', "events", "PATH", "1", path_check,
+                     "path of the socket which publishes applied changes");
+    // * Shared memory
+    argparse_add_opt(ap, 'M', "shm", "PATH", "1", path_check,
+                     "path of the shared memory file (e.g. in /dev/shm)");
+    // * State journal
+    argparse_add_opt(ap, 'j', "journal", "FILE", "1", path_check,
+                     "journal of the state to resume after a restart");
+    // * Wire trace
+    argparse_add_opt(ap, 't', "trace", "FILE", "1", path_check,
+                     "record the serial communication to a trace file");
+    argparse_add_opt(ap, 'r', "replay", "FILE", "1", file_check,
+                     "replay a recorded trace file and exit");
+    // * Path loss series
+    argparse_add_opt(ap, 'p', "playback", "FILE", "1", file_check,
+                     "path loss series to play back");
+    // * Virtual time simulation
+    argparse_add_opt(ap, 'S', "simulate", "SECONDS", "1", duration_check,
+                     "simulate the scenario in virtual time and exit");
     // Parse command line arguments
     args = argparse_parse(ap, argc, argv);
     delete(ap);
@@ -102,6 +210,45 @@ static void merge_cmdline_args(Map *args)
     if (!is_none(device)) {
         cfg.ada.device = str_cstr(device);
     }
+    // Control socket
+    Str *socket = map_get(args, "socket");
+    if (!is_none(socket)) {
+        cfg.control_socket = str_cstr(socket);
+    }
+    // Event socket
+    Str *events = map_get(args, "events");
+    if (!is_none(events)) {
+        cfg.event_socket = str_cstr(events);
+    }
+    // Shared memory
+    Str *shm = map_get(args, "shm");
+    if (!is_none(shm)) {
+        cfg.shm_path = str_cstr(shm);
+    }
+    // State journal
+    Str *journal = map_get(args, "journal");
+    if (!is_none(journal)) {
+        cfg.journal_file = str_cstr(journal);
+    }
+    // Wire trace
+    Str *trace = map_get(args, "trace");
+    if (!is_none(trace)) {
+        cfg.trace_file = str_cstr(trace);
+    }
+    Str *replay = map_get(args, "replay");
+    if (!is_none(replay)) {
+        cfg.replay_file = str_cstr(replay);
+    }
+    // Path loss series
+    Str *playback = map_get(args, "playback");
+    if (!is_none(playback)) {
+        cfg.playback_file = str_cstr(playback);
+    }
+    // Virtual time simulation
+    Int *simulate = map_get(args, "simulate");
+    if (!is_none(simulate)) {
+        cfg.simulation.duration = int_get(simulate);
+    }
 }
 
 static Str *path_expanduser(const char *path)
@@ -192,6 +339,213 @@ static bool parse_channel_groups(List *groups, Str **err_msg)
     return *err_msg == NULL;
 }
 
+static int parse_points(List *points, MobPoint *pts, int max, Str **err_msg)
+{
+    int n = 0;
+    Iter itr = init(Iter, points);
+    for (List *p = next(&itr); p != NULL; p = next(&itr)) {
+        if (n >= max) {
+            *err_msg = str_new("too many points! (%O)", points);
+        } else if (!isinstance(p, List) || len(p) != 2
+                || !isinstance(list_get_at(p, 0), Num)
+                || !isinstance(list_get_at(p, 1), Num)) {
+            *err_msg = str_new("invalid point! (%O)", p);
+        } else {
+            pts[n].x = to_double(list_get_at(p, 0));
+            pts[n].y = to_double(list_get_at(p, 1));
+            n++;
+            continue;
+        }
+        n = -1;
+        break;
+    }
+    destroy(&itr);
+    return n;
+}
+
+static bool parse_mobility_num(Map *mob, const char *key, double *value,
+        Str **err_msg)
+{
+    Object *obj = map_get(mob, key);
+    if (isinstance(obj, Num)) {
+        *value = to_double((Num *)obj);
+    } else if (!is_none(obj)) {
+        *err_msg = str_new("Expecting type Num for mobility '%s'!", key);
+        return false;
+    }
+    return true;
+}
+
+static bool parse_mobility(Map *mob, Str **err_msg)
+{
+    MobilityConfig *mc = &cfg.mobility;
+    Object *aps_obj = map_get(mob, "aps");
+    Object *wps_obj = map_get(mob, "waypoints");
+    if (!isinstance(aps_obj, List) || !isinstance(wps_obj, List)) {
+        *err_msg = str_new("mobility needs lists of 'aps' and 'waypoints'!");
+        return false;
+    }
+    mc->n_aps = parse_points((List *)aps_obj, mc->aps, ADACOM_MAX_CHANNELS,
+            err_msg);
+    if (mc->n_aps < 0)
+        return false;
+    mc->n_waypoints = parse_points((List *)wps_obj, mc->waypoints,
+            MOBILITY_MAX_WAYPOINTS, err_msg);
+    if (mc->n_waypoints < 0)
+        return false;
+    if (!parse_mobility_num(mob, "speed", &mc->params.speed, err_msg)
+            || !parse_mobility_num(mob, "pl_ref", &mc->params.pl_ref, err_msg)
+            || !parse_mobility_num(mob, "pl_exp", &mc->params.pl_exp, err_msg)
+            || !parse_mobility_num(mob, "pl_d0", &mc->params.pl_d0, err_msg)
+            || !parse_mobility_num(mob, "pl_offset", &mc->params.pl_offset,
+                    err_msg))
+        return false;
+    Object *loops_obj = map_get(mob, "loops");
+    if (isinstance(loops_obj, Int)) {
+        mc->params.loops = int_get((Int *)loops_obj);
+    } else if (!is_none(loops_obj)) {
+        *err_msg = str_new("Expecting type Int for mobility 'loops'!");
+        return false;
+    }
+    return true;
+}
+
+static bool parse_fading(Map *fading, Str **err_msg)
+{
+    Object *seed_obj = map_get(fading, "seed");
+    Object *sigma_obj = map_get(fading, "sigma");
+    Object *corr_obj = map_get(fading, "correlation_time");
+    if (isinstance(seed_obj, Int)) {
+        cfg.fading.seed = int_get((Int *)seed_obj);
+    } else if (!is_none(seed_obj)) {
+        *err_msg = str_new("Expecting type Int for fading 'seed'!");
+        return false;
+    }
+    if (!isinstance(sigma_obj, Num) || to_double((Num *)sigma_obj) < 0) {
+        *err_msg = str_new("fading needs a non-negative 'sigma' in dB!");
+        return false;
+    }
+    cfg.fading.sigma = to_double((Num *)sigma_obj);
+    if (isinstance(corr_obj, Int) && int_get((Int *)corr_obj) > 0) {
+        cfg.fading.correlation_time = int_get((Int *)corr_obj);
+    } else if (!is_none(corr_obj)) {
+        *err_msg = str_new("Value of fading 'correlation_time' is invalid!");
+        return false;
+    }
+    return true;
+}
+
+static bool parse_simulation(Map *sim, Str **err_msg)
+{
+    Object *channels_obj = map_get(sim, "channels");
+    Object *latency_obj = map_get(sim, "cmd_latency");
+    if (isinstance(channels_obj, Int)) {
+        int channels = int_get((Int *)channels_obj);
+        if (channels < 1 || channels > ADACOM_MAX_CHANNELS) {
+            *err_msg = str_new("Value of simulation 'channels' is out of "
+                    "range (1 - %i)!", ADACOM_MAX_CHANNELS);
+            return false;
+        }
+        cfg.simulation.channels = channels;
+    } else if (!is_none(channels_obj)) {
+        *err_msg = str_new("Expecting type Int for simulation 'channels'!");
+        return false;
+    }
+    if (isinstance(latency_obj, Num) && to_double((Num *)latency_obj) >= 0) {
+        cfg.simulation.cmd_latency = to_double((Num *)latency_obj);
+    } else if (!is_none(latency_obj)) {
+        *err_msg = str_new("Value of simulation 'cmd_latency' is invalid!");
+        return false;
+    }
+    return true;
+}
+
+static bool parse_io_thread(Map *io, Str **err_msg)
+{
+    Object *cpu_obj = map_get(io, "cpu");
+    Object *prio_obj = map_get(io, "rt_priority");
+    if (isinstance(cpu_obj, Int)) {
+        cfg.io_thread.cpu = int_get((Int *)cpu_obj);
+    } else if (!is_none(cpu_obj)) {
+        *err_msg = str_new("Expecting type Int for io_thread 'cpu'!");
+        return false;
+    }
+    if (isinstance(prio_obj, Int) && int_in_range((Int *)prio_obj, 0, 99)) {
+        cfg.io_thread.rt_priority = int_get((Int *)prio_obj);
+    } else if (!is_none(prio_obj)) {
+        *err_msg = str_new("Value of io_thread 'rt_priority' is invalid!");
+        return false;
+    }
+    cfg.io_thread.enabled = true;
+    return true;
+}
+
+static bool parse_verify(Map *verify, Str **err_msg)
+{
+    Object *interval_obj = map_get(verify, "interval");
+    Object *idle_obj = map_get(verify, "idle");
+    Object *action_obj = map_get(verify, "action");
+    if (isinstance(interval_obj, Int) && int_get((Int *)interval_obj) >= 0) {
+        cfg.verify.interval = int_get((Int *)interval_obj);
+    } else if (!is_none(interval_obj)) {
+        *err_msg = str_new("Value of verify 'interval' is invalid!");
+        return false;
+    }
+    if (isinstance(idle_obj, Int) && int_get((Int *)idle_obj) > 0) {
+        cfg.verify.idle = int_get((Int *)idle_obj);
+    } else if (!is_none(idle_obj)) {
+        *err_msg = str_new("Value of verify 'idle' is invalid!");
+        return false;
+    }
+    if (isinstance(action_obj, Str) && (str_eq_cstr((Str *)action_obj, "mirror")
+            || str_eq_cstr((Str *)action_obj, "repush"))) {
+        cfg.verify.repush = str_eq_cstr((Str *)action_obj, "repush");
+    } else if (!is_none(action_obj)) {
+        *err_msg = str_new("verify 'action' has to be 'mirror' or 'repush'!");
+        return false;
+    }
+    return true;
+}
+
+static bool parse_unacked(Map *unacked, Str **err_msg)
+{
+    Object *checkpoint_obj = map_get(unacked, "checkpoint");
+    if (isinstance(checkpoint_obj, Int) && int_get((Int *)checkpoint_obj) >= 0) {
+        cfg.unacked.checkpoint = int_get((Int *)checkpoint_obj);
+    } else if (!is_none(checkpoint_obj)) {
+        *err_msg = str_new("Value of unacked 'checkpoint' is invalid!");
+        return false;
+    }
+    cfg.unacked.enabled = true;
+    return true;
+}
+
+static bool parse_metrics(Map *metrics, Str **err_msg)
+{
+    Object *file_obj = map_get(metrics, "file");
+    Object *interval_obj = map_get(metrics, "interval");
+    Object *port_obj = map_get(metrics, "port");
+    if (isinstance(file_obj, Str)) {
+        cfg.metrics.file = str_cstr((Str *)file_obj);
+    } else if (!is_none(file_obj)) {
+        *err_msg = str_new("Expecting type Str for metrics 'file'!");
+        return false;
+    }
+    if (isinstance(interval_obj, Int) && int_get((Int *)interval_obj) > 0) {
+        cfg.metrics.interval = int_get((Int *)interval_obj);
+    } else if (!is_none(interval_obj)) {
+        *err_msg = str_new("Value of metrics 'interval' is invalid!");
+        return false;
+    }
+    if (isinstance(port_obj, Int) && int_in_range((Int *)port_obj, 1, 65535)) {
+        cfg.metrics.port = int_get((Int *)port_obj);
+    } else if (!is_none(port_obj)) {
+        *err_msg = str_new("Value of metrics 'port' is invalid!");
+        return false;
+    }
+    return true;
+}
+
 static void parse_config_file(Json *js)
 {
     Str *err_msg = NULL;
@@ -207,6 +561,14 @@ static void parse_config_file(Json *js)
             goto out;
         }
     }
+    Object *debug_log_obj = json_get_node(js, "debug_log");
+    if (isinstance(debug_log_obj, Str) && (str_eq_cstr((Str *)debug_log_obj,
+            "direct") || str_eq_cstr((Str *)debug_log_obj, "lazy"))) {
+        cfg.lazy_debug_log = str_eq_cstr((Str *)debug_log_obj, "lazy");
+    } else if (!is_none(debug_log_obj)) {
+        err_msg = str_new("debug_log has to be 'direct' or 'lazy'!");
+        goto out;
+    }
     // Device path
     Object *device_obj = json_get_node(js, "device");
     if (isinstance(device_obj, Str)) {
@@ -247,6 +609,161 @@ static void parse_config_file(Json *js)
                 name_of(channels_obj), channels_obj);
         goto out;
     }
+    // Control socket
+    Object *socket_obj = json_get_node(js, "control_socket");
+    if (isinstance(socket_obj, Str)) {
+        cfg.control_socket = str_cstr((Str *)socket_obj);
+    } else if (!is_none(socket_obj)) {
+        err_msg = str_new("invalid type <%s> for control_socket! (%O)",
+                name_of(socket_obj), socket_obj);
+        goto out;
+    }
+    // Event socket
+    Object *events_obj = json_get_node(js, "event_socket");
+    if (isinstance(events_obj, Str)) {
+        cfg.event_socket = str_cstr((Str *)events_obj);
+    } else if (!is_none(events_obj)) {
+        err_msg = str_new("invalid type <%s> for event_socket! (%O)",
+                name_of(events_obj), events_obj);
+        goto out;
+    }
+    // Shared memory
+    Object *shm_obj = json_get_node(js, "shm_path");
+    if (isinstance(shm_obj, Str)) {
+        cfg.shm_path = str_cstr((Str *)shm_obj);
+    } else if (!is_none(shm_obj)) {
+        err_msg = str_new("invalid type <%s> for shm_path! (%O)",
+                name_of(shm_obj), shm_obj);
+        goto out;
+    }
+    // State journal
+    Object *journal_obj = json_get_node(js, "journal_file");
+    if (isinstance(journal_obj, Str)) {
+        cfg.journal_file = str_cstr((Str *)journal_obj);
+    } else if (!is_none(journal_obj)) {
+        err_msg = str_new("invalid type <%s> for journal_file! (%O)",
+                name_of(journal_obj), journal_obj);
+        goto out;
+    }
+    // Path loss series and the channels of its columns
+    Object *playback_obj = json_get_node(js, "playback_file");
+    if (isinstance(playback_obj, Str)) {
+        cfg.playback_file = str_cstr((Str *)playback_obj);
+    } else if (!is_none(playback_obj)) {
+        err_msg = str_new("invalid type <%s> for playback_file! (%O)",
+                name_of(playback_obj), playback_obj);
+        goto out;
+    }
+    Object *pb_chs_obj = json_get_node(js, "playback_channels");
+    if (isinstance(pb_chs_obj, List)) {
+        cfg.playback_channels = parse_channel_list((List *)pb_chs_obj,
+                &err_msg);
+        if (cfg.playback_channels == NULL) {
+            goto out;
+        }
+    } else if (!is_none(pb_chs_obj)) {
+        err_msg = str_new("invalid type <%s> for playback_channels! (%O)",
+                name_of(pb_chs_obj), pb_chs_obj);
+        goto out;
+    }
+    // Mobility and path loss model
+    Object *mobility_obj = json_get_node(js, "mobility");
+    if (isinstance(mobility_obj, Map)) {
+        if (!parse_mobility((Map *)mobility_obj, &err_msg)) {
+            goto out;
+        }
+    } else if (!is_none(mobility_obj)) {
+        err_msg = str_new("invalid type <%s> for mobility! (%O)",
+                name_of(mobility_obj), mobility_obj);
+        goto out;
+    }
+    // Slow fading overlay
+    Object *fading_obj = json_get_node(js, "fading");
+    if (isinstance(fading_obj, Map)) {
+        if (!parse_fading((Map *)fading_obj, &err_msg)) {
+            goto out;
+        }
+    } else if (!is_none(fading_obj)) {
+        err_msg = str_new("invalid type <%s> for fading! (%O)",
+                name_of(fading_obj), fading_obj);
+        goto out;
+    }
+    // Background verification of the attenuations
+    Object *verify_obj = json_get_node(js, "verify");
+    if (isinstance(verify_obj, Map)) {
+        if (!parse_verify((Map *)verify_obj, &err_msg)) {
+            goto out;
+        }
+    } else if (!is_none(verify_obj)) {
+        err_msg = str_new("invalid type <%s> for verify! (%O)",
+                name_of(verify_obj), verify_obj);
+        goto out;
+    }
+    // Unacknowledged handoff steps
+    Object *unacked_obj = json_get_node(js, "unacked");
+    if (isinstance(unacked_obj, Map)) {
+        if (!parse_unacked((Map *)unacked_obj, &err_msg)) {
+            goto out;
+        }
+    } else if (!is_none(unacked_obj)) {
+        err_msg = str_new("invalid type <%s> for unacked! (%O)",
+                name_of(unacked_obj), unacked_obj);
+        goto out;
+    }
+    // Prometheus metrics
+    Object *metrics_obj = json_get_node(js, "metrics");
+    if (isinstance(metrics_obj, Map)) {
+        if (!parse_metrics((Map *)metrics_obj, &err_msg)) {
+            goto out;
+        }
+    } else if (!is_none(metrics_obj)) {
+        err_msg = str_new("invalid type <%s> for metrics! (%O)",
+                name_of(metrics_obj), metrics_obj);
+        goto out;
+    }
+    // Serial transport on a dedicated thread
+    Object *io_obj = json_get_node(js, "io_thread");
+    if (isinstance(io_obj, Map)) {
+        if (!parse_io_thread((Map *)io_obj, &err_msg)) {
+            goto out;
+        }
+    } else if (!is_none(io_obj)) {
+        err_msg = str_new("invalid type <%s> for io_thread! (%O)",
+                name_of(io_obj), io_obj);
+        goto out;
+    }
+    // Simulated device
+    Object *sim_obj = json_get_node(js, "simulation");
+    if (isinstance(sim_obj, Map)) {
+        if (!parse_simulation((Map *)sim_obj, &err_msg)) {
+            goto out;
+        }
+    } else if (!is_none(sim_obj)) {
+        err_msg = str_new("invalid type <%s> for simulation! (%O)",
+                name_of(sim_obj), sim_obj);
+        goto out;
+    }
+    // Presets for the one-shot preset command
+    Object *presets_obj = json_get_node(js, "presets");
+    if (isinstance(presets_obj, List)) {
+        Iter itr = init(Iter, presets_obj);
+        for (Map *p = next(&itr); p != NULL; p = next(&itr)) {
+            if (!isinstance(p, Map) || !isinstance(map_get(p, "name"), Str)
+                    || !isinstance(map_get(p, "values"), List)) {
+                err_msg = str_new("invalid preset! (%O)", p);
+                break;
+            }
+        }
+        destroy(&itr);
+        if (err_msg != NULL) {
+            goto out;
+        }
+        cfg.presets = (List *)presets_obj;
+    } else if (!is_none(presets_obj)) {
+        err_msg = str_new("invalid type <%s> for presets! (%O)",
+                name_of(presets_obj), presets_obj);
+        goto out;
+    }
     // Minimum attenuation
     Object *min_atten_obj = json_get_node(js, "min_attenuation");
     if (!is_none(min_atten_obj)) {
@@ -337,6 +854,15 @@ static void parse_config_file(Json *js)
         }
         cfg.recovery_time = time;
     }
+    // Dispatch lead
+    Object *lead_obj = json_get_node(js, "dispatch_lead");
+    if (!is_none(lead_obj)) {
+        if (!isinstance(lead_obj, Num)) {
+            err_msg = str_new("Expecting type Num for 'dispatch_lead'!");
+            goto out;
+        }
+        cfg.dispatch_lead = to_double((Num *)lead_obj);
+    }
     return;
 out:
     fprint(stderr, "%s: error: %O\n", prog_name, err_msg);
@@ -348,6 +874,14 @@ void cfg_init(int argc, char *argv[])
 {
     // Initialise default configuration
     cfg.groups = new(List);
+    Str *cache_file = path_expanduser(cache_file_path);
+    cfg.cache_file = strdup(cache_file->cstr);
+    delete(cache_file);
+    Str *profile_dir = path_expanduser(profile_dir_path);
+    cfg.profile_dir = strdup(profile_dir->cstr);
+    delete(profile_dir);
+    // Take a one-shot command (e.g. adacon set 1=10) out of the arguments
+    argc = split_command(argc, argv);
     // First parse command line arguments to get config file path
     cmdline_args = parse_cmdline_args(argc, argv);
     Json *cfg_js = map_get(cmdline_args, "cfg-file");
@@ -375,10 +909,30 @@ bool cfg_is_in_channels(int channel)
     return list_is_in(cfg.channels, &ch);
 }
 
+List *cfg_get_preset(const char *name)
+{
+    List *values = NULL;
+    if (cfg.presets == NULL)
+        return NULL;
+    Iter itr = init(Iter, cfg.presets);
+    for (Map *p = next(&itr); p != NULL; p = next(&itr)) {
+        if (str_eq_cstr(map_get(p, "name"), name)) {
+            values = map_get(p, "values");
+            break;
+        }
+    }
+    destroy(&itr);
+    return values;
+}
+
 void cfg_destroy(void)
 {
+    free(cfg.cmd.argv);
+    free(cfg.cache_file);
+    free(cfg.profile_dir);
     free(cfg.file_path);
     delete(cmdline_args);
     delete(cfg.channels);
+    delete(cfg.playback_channels);
     delete(cfg.groups);
 }
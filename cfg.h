@@ -3,6 +3,8 @@
 
 #include <masc.h>
 
+#include "mobility.h"
+
 #define CFG_SAMPLE_RATE_MIN 1
 #define CFG_SAMPLE_RATE_MAX 100
 #define CFG_ACTION_TIME_MIN 0
@@ -13,8 +15,68 @@ typedef struct {
     const char *device;
 } AdauraConfig;
 
+typedef struct {
+    const char *name;
+    int argc;
+    char **argv;
+} CommandConfig;
+
+typedef struct {
+    MobParams params;
+    MobPoint aps[ADACOM_MAX_CHANNELS];
+    int n_aps;
+    MobPoint waypoints[MOBILITY_MAX_WAYPOINTS];
+    int n_waypoints;
+} MobilityConfig;
+
+typedef struct {
+    uint64_t seed;
+    double sigma;
+    int correlation_time;
+} FadingConfig;
+
+typedef struct {
+    // Simulated time in seconds (0: no simulation)
+    int duration;
+    int channels;
+    double cmd_latency;
+} SimulationConfig;
+
+typedef struct {
+    bool enabled;
+    int cpu;
+    int rt_priority;
+} IoThreadConfig;
+
+typedef struct {
+    // Interval of the background verification in ms (0: disabled)
+    int interval;
+    // Minimal time in ms without commands before the device is read back
+    int idle;
+    // Push the target again instead of taking over the device values
+    bool repush;
+} VerifyConfig;
+
+typedef struct {
+    // Stream the intermediate handoff steps without acknowledgement
+    bool enabled;
+    // Every checkpoint-th step is acknowledged (0: only the final one)
+    int checkpoint;
+} UnackedConfig;
+
+typedef struct {
+    // Node exporter textfile (NULL: not written)
+    const char *file;
+    // Interval of the textfile updates in ms
+    int interval;
+    // Port of the HTTP endpoint on localhost (0: disabled)
+    int port;
+} MetricsConfig;
+
 typedef struct {
     int log_level;
+    // Format hot path debug messages in a timer instead of in place
+    bool lazy_debug_log;
     char *file_path;
     AdauraConfig ada;
     List *groups;
@@ -25,6 +87,27 @@ typedef struct {
     int sample_rate;
     int action_time;
     int recovery_time;
+    // Time in ms handoff commands are sent ahead (negative: measured)
+    double dispatch_lead;
+    const char *control_socket;
+    const char *event_socket;
+    const char *shm_path;
+    const char *journal_file;
+    const char *trace_file;
+    const char *replay_file;
+    const char *playback_file;
+    List *playback_channels;
+    MobilityConfig mobility;
+    FadingConfig fading;
+    SimulationConfig simulation;
+    IoThreadConfig io_thread;
+    VerifyConfig verify;
+    UnackedConfig unacked;
+    MetricsConfig metrics;
+    CommandConfig cmd;
+    List *presets;
+    char *cache_file;
+    char *profile_dir;
 } Config;
 
 
@@ -33,6 +116,7 @@ extern Config cfg;
 
 void cfg_init(int argc, char *argv[]);
 bool cfg_is_in_channels(int ch);
+List *cfg_get_preset(const char *name);
 void cfg_destroy(void);
 
 #endif /* _CFG_H_ */
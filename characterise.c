@@ -0,0 +1,337 @@
+/*
+ * Device characterisation: adacon characterise sweeps step sizes, set all
+ * sequences and bursts against the connected unit and writes the timing
+ * profile of its model.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <masc.h>
+
+#include "cfg.h"
+#include "adacom.h"
+#include "hist.h"
+#include "profile.h"
+#include "characterise.h"
+
+// Measured commands per configuration (plus one unrecorded warm-up command)
+#define CHAR_REPS 20
+// Measured bursts of each size (after a warm-up burst)
+#define CHAR_BURST_REPS 5
+// Idle time in ms between two bursts
+#define CHAR_BURST_GAP 200
+
+
+typedef enum {
+    CHAR_PHASE_STEPS,
+    CHAR_PHASE_SET_ALL,
+    CHAR_PHASE_BURSTS,
+    CHAR_PHASE_RESTORE,
+    CHAR_PHASE_DONE
+} CharPhase;
+
+
+static const double steps[] = { 0.25, 1, 5, 10, 30, 90 };
+static const int bursts[] = { 1, 4, 16, 64 };
+
+static CharPhase phase;
+static int idx;
+static int rep;
+static int burst_pos;
+static int n_channels;
+static uint64_t cmd_start;
+static uint64_t burst_start;
+static double orig[ADACOM_MAX_CHANNELS];
+static MlTimer *gap_timer = NULL;
+static int exit_code = 1;
+// Latencies in us
+static Hist set_hist;
+static Hist step_hists[ARRAY_LEN(steps)];
+static Hist set_all_hists[ADACOM_MAX_CHANNELS];
+static Hist burst_hists[ARRAY_LEN(bursts)];
+// Sum of the burst durations in us
+static uint64_t burst_time[ARRAY_LEN(bursts)];
+
+
+static void run_next(void);
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "Characterisation failed: %s!\n", what);
+    mloop_stop();
+}
+
+static void set_cb(AdaComError err, int ch, double value)
+{
+    if (err != ADACOM_OK) {
+        fail("set command");
+        return;
+    }
+    uint64_t latency = now_us() - cmd_start;
+    // The first command of each configuration is a warm-up
+    if (phase == CHAR_PHASE_STEPS && rep > 0) {
+        hist_record(&step_hists[idx], latency);
+        hist_record(&set_hist, latency);
+    } else if (phase == CHAR_PHASE_BURSTS && burst_pos > 1) {
+        // The first burst of each size is a warm-up
+        hist_record(&burst_hists[idx], latency);
+    }
+    rep++;
+    run_next();
+}
+
+static void set_all_cb(AdaComError err, double *values, int n)
+{
+    if (err != ADACOM_OK) {
+        fail("set all command");
+        return;
+    }
+    if (phase == CHAR_PHASE_SET_ALL && rep > 0) {
+        hist_record(&set_all_hists[idx], now_us() - cmd_start);
+    }
+    rep++;
+    run_next();
+}
+
+static bool send_set(int ch, double value)
+{
+    cmd_start = now_us();
+    if (adacom_set_channel(ch, value, set_cb) != ADACOM_OK) {
+        fail("unable to send command");
+        return false;
+    }
+    return true;
+}
+
+static void run_steps(void)
+{
+    if (rep > CHAR_REPS) {
+        rep = 0;
+        idx++;
+    }
+    if (idx >= ARRAY_LEN(steps)) {
+        phase = CHAR_PHASE_SET_ALL;
+        idx = 0;
+        rep = 0;
+        run_next();
+        return;
+    }
+    // Toggle channel 1 by the step size, the warm-up goes to the base value
+    send_set(0, rep % 2 ? steps[idx] : 0);
+}
+
+static void run_set_all(void)
+{
+    if (rep > CHAR_REPS) {
+        rep = 0;
+        idx++;
+    }
+    if (idx >= n_channels) {
+        phase = CHAR_PHASE_BURSTS;
+        idx = 0;
+        rep = 0;
+        burst_pos = 0;
+        run_next();
+        return;
+    }
+    // Toggle the first idx + 1 channels by 1 dB
+    double values[n_channels];
+    adacom_get_all(values, n_channels);
+    for (int ch = 0; ch <= idx; ch++) {
+        values[ch] = rep % 2 ? 1 : 0;
+    }
+    cmd_start = now_us();
+    if (adacom_set_all(values, n_channels, set_all_cb) != ADACOM_OK) {
+        fail("unable to send command");
+    } else if (!adacom_is_busy()) {
+        // Nothing to change (warm-up on already set values)
+        set_all_cb(ADACOM_OK, values, n_channels);
+    }
+}
+
+static void gap_timer_cb(MlTimer *timer, void *arg)
+{
+    burst_start = now_us();
+    send_set(0, 1);
+}
+
+static void run_bursts(void)
+{
+    if (burst_pos > 0 && rep == bursts[idx]) {
+        // Burst is complete
+        if (burst_pos > 1) {
+            burst_time[idx] += now_us() - burst_start;
+        }
+        rep = 0;
+        if (burst_pos == CHAR_BURST_REPS + 1) {
+            burst_pos = 0;
+            idx++;
+        }
+    }
+    if (idx >= ARRAY_LEN(bursts)) {
+        phase = CHAR_PHASE_RESTORE;
+        if (adacom_set_all(orig, n_channels, set_all_cb) != ADACOM_OK) {
+            fail("unable to restore attenuations");
+        } else if (!adacom_is_busy()) {
+            run_next();
+        }
+        return;
+    }
+    if (rep == 0) {
+        // Start the next burst after an idle gap
+        burst_pos++;
+        ml_timer_in(gap_timer, CHAR_BURST_GAP);
+        return;
+    }
+    send_set(0, rep % 2 ? 0 : 1);
+}
+
+static void run_next(void)
+{
+    if (phase == CHAR_PHASE_STEPS) {
+        run_steps();
+    } else if (phase == CHAR_PHASE_SET_ALL) {
+        run_set_all();
+    } else if (phase == CHAR_PHASE_BURSTS) {
+        run_bursts();
+    } else if (phase == CHAR_PHASE_RESTORE) {
+        phase = CHAR_PHASE_DONE;
+        exit_code = 0;
+        mloop_stop();
+    }
+}
+
+static double ms(uint64_t us)
+{
+    return us / 1000.0;
+}
+
+static void write_hist(FILE *f, const Hist *h)
+{
+    fprintf(f, "\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f",
+            ms(hist_percentile(h, 50)), ms(hist_percentile(h, 99)),
+            ms(h->max));
+}
+
+static double burst_rate(int i)
+{
+    if (burst_time[i] == 0)
+        return 0;
+    return bursts[i] * CHAR_BURST_REPS * 1000000.0 / burst_time[i];
+}
+
+static bool write_profile(void)
+{
+    FILE *f = profile_create(adacom_model());
+    if (f == NULL)
+        return false;
+    // The longest burst gives the sustainable rate
+    double max_rate = burst_rate(ARRAY_LEN(bursts) - 1);
+    fprintf(f, "{\n  \"model\": \"%s\",\n  \"channels\": %i,\n",
+            adacom_model(), n_channels);
+    fprintf(f, "  \"set_p50\": %.3f,\n  \"set_p99\": %.3f,\n"
+            "  \"set_max\": %.3f,\n  \"max_rate\": %.1f,\n",
+            ms(hist_percentile(&set_hist, 50)),
+            ms(hist_percentile(&set_hist, 99)), ms(set_hist.max), max_rate);
+    fprintf(f, "  \"steps\": [\n");
+    for (int i = 0; i < ARRAY_LEN(steps); i++) {
+        fprintf(f, "    {\"step\": %.2f, ", steps[i]);
+        write_hist(f, &step_hists[i]);
+        fprintf(f, "}%s\n", i < ARRAY_LEN(steps) - 1 ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"set_all\": [\n");
+    for (int i = 0; i < n_channels; i++) {
+        fprintf(f, "    {\"channels\": %i, ", i + 1);
+        write_hist(f, &set_all_hists[i]);
+        fprintf(f, "}%s\n", i < n_channels - 1 ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"bursts\": [\n");
+    for (int i = 0; i < ARRAY_LEN(bursts); i++) {
+        fprintf(f, "    {\"length\": %i, \"rate\": %.1f, ", bursts[i],
+                burst_rate(i));
+        write_hist(f, &burst_hists[i]);
+        fprintf(f, "}%s\n", i < ARRAY_LEN(bursts) - 1 ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return true;
+}
+
+static void print_summary(void)
+{
+    printf("%s (%s), %i channels\n", adacom_model(), adacom_sn(), n_channels);
+    printf("set latency [ms]: p50 %.2f, p99 %.2f, max %.2f\n",
+            ms(hist_percentile(&set_hist, 50)),
+            ms(hist_percentile(&set_hist, 99)), ms(set_hist.max));
+    for (int i = 0; i < ARRAY_LEN(steps); i++) {
+        printf("  step %6.2f dB: p50 %.2f ms\n", steps[i],
+                ms(hist_percentile(&step_hists[i], 50)));
+    }
+    for (int i = 0; i < n_channels; i++) {
+        printf("  set all %2i channels: p50 %.2f ms\n", i + 1,
+                ms(hist_percentile(&set_all_hists[i], 50)));
+    }
+    for (int i = 0; i < ARRAY_LEN(bursts); i++) {
+        printf("  burst of %2i: %.1f commands/s, p99 %.2f ms\n", bursts[i],
+                burst_rate(i), ms(hist_percentile(&burst_hists[i], 99)));
+    }
+}
+
+static void connect_cb(AdaComError err)
+{
+    if (err != ADACOM_OK) {
+        fprintf(stderr, "Unable to connect to '%s'!\n", cfg.ada.device);
+        mloop_stop();
+        return;
+    }
+    n_channels = adacom_num_channels();
+    adacom_get_all(orig, n_channels);
+    printf("Characterising %s (%s), this takes a while ...\n",
+            adacom_model(), adacom_sn());
+    phase = CHAR_PHASE_STEPS;
+    idx = 0;
+    rep = 0;
+    run_next();
+}
+
+int characterise_run(void)
+{
+    hist_reset(&set_hist);
+    for (int i = 0; i < ARRAY_LEN(steps); i++) {
+        hist_reset(&step_hists[i]);
+    }
+    for (int i = 0; i < ADACOM_MAX_CHANNELS; i++) {
+        hist_reset(&set_all_hists[i]);
+    }
+    for (int i = 0; i < ARRAY_LEN(bursts); i++) {
+        hist_reset(&burst_hists[i]);
+        burst_time[i] = 0;
+    }
+    adacom_init(cfg.ada.device);
+    adacom_set_io_thread(cfg.io_thread.enabled, cfg.io_thread.cpu,
+            cfg.io_thread.rt_priority);
+    gap_timer = new(MlTimer, gap_timer_cb, NULL);
+    if (adacom_connect(connect_cb) == ADACOM_OK) {
+        mloop_run();
+    } else {
+        fprintf(stderr, "Unable to connect to '%s'!\n", cfg.ada.device);
+    }
+    if (exit_code == 0) {
+        print_summary();
+        if (!write_profile()) {
+            fprintf(stderr, "Unable to write the profile to '%s'!\n",
+                    cfg.profile_dir);
+            exit_code = 1;
+        }
+    }
+    delete(gap_timer);
+    adacom_destroy();
+    return exit_code;
+}
@@ -0,0 +1,6 @@
+#ifndef _CHARACTERISE_H_
+#define _CHARACTERISE_H_
+
+int characterise_run(void);
+
+#endif /* _CHARACTERISE_H_ */
@@ -0,0 +1,235 @@
+/*
+ * One-shot commands: adacon set CH=VALUE ..., adacon get, adacon preset NAME
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <masc.h>
+
+#include "cfg.h"
+#include "adacom.h"
+#include "cli.h"
+
+
+typedef enum {
+    CLI_CMD_SET,
+    CLI_CMD_GET,
+    CLI_CMD_PRESET
+} CliCmd;
+
+
+static CliCmd cmd;
+static int n_values = 0;
+static int channels[ADACOM_MAX_CHANNELS];
+static double values[ADACOM_MAX_CHANNELS];
+static bool cache_used = false;
+static int exit_code = 1;
+
+
+static bool parse_set_args(void)
+{
+    for (int i = 0; i < cfg.cmd.argc; i++) {
+        int ch;
+        double value;
+        if (n_values >= ADACOM_MAX_CHANNELS
+                || sscanf(cfg.cmd.argv[i], "%i=%lf", &ch, &value) != 2
+                || ch < 1) {
+            fprintf(stderr, "Invalid argument '%s'!\n", cfg.cmd.argv[i]);
+            return false;
+        }
+        channels[n_values] = ch - 1;
+        values[n_values++] = value;
+    }
+    return n_values > 0;
+}
+
+static bool parse_preset_args(void)
+{
+    if (cfg.cmd.argc != 1)
+        return false;
+    List *preset = cfg_get_preset(cfg.cmd.argv[0]);
+    if (preset == NULL) {
+        fprintf(stderr, "Unknown preset '%s'!\n", cfg.cmd.argv[0]);
+        return false;
+    }
+    Iter itr = init(Iter, preset);
+    for (Num *v = next(&itr); v != NULL; v = next(&itr)) {
+        if (n_values >= ADACOM_MAX_CHANNELS || !isinstance(v, Num))
+            break;
+        channels[n_values] = n_values;
+        values[n_values++] = to_double(v);
+    }
+    destroy(&itr);
+    return true;
+}
+
+static bool read_cache(Str **model, Str **sn, int *n)
+{
+    FILE *f = fopen(cfg.cache_file, "r");
+    if (f == NULL)
+        return false;
+    char buf[512];
+    size_t size = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[size] = '\0';
+    bool ok = false;
+    Json *js = json_new_cstr(buf);
+    if (json_is_valid(js)) {
+        Object *dev = json_get_node(js, "device");
+        Object *model_obj = json_get_node(js, "model");
+        Object *sn_obj = json_get_node(js, "sn");
+        Object *n_obj = json_get_node(js, "channels");
+        // The cache is only valid for the same device
+        if (isinstance(dev, Str) && str_eq_cstr((Str *)dev, cfg.ada.device)
+                && isinstance(model_obj, Str) && isinstance(sn_obj, Str)
+                && isinstance(n_obj, Int)) {
+            *model = new_copy(model_obj);
+            *sn = new_copy(sn_obj);
+            *n = int_get((Int *)n_obj);
+            ok = true;
+        }
+    }
+    delete(js);
+    return ok;
+}
+
+static void put_json_str(FILE *f, const char *key, const char *value)
+{
+    fprintf(f, "\"%s\": \"", key);
+    for (const char *c = value; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(f, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(f, "\\u%04x", *c);
+        } else {
+            fputc(*c, f);
+        }
+    }
+    fputs("\", ", f);
+}
+
+static void write_cache(void)
+{
+    FILE *f = fopen(cfg.cache_file, "w");
+    if (f == NULL) {
+        log_debug("cli: Unable to write cache '%s'!", cfg.cache_file);
+        return;
+    }
+    fputc('{', f);
+    put_json_str(f, "device", cfg.ada.device);
+    put_json_str(f, "model", adacom_model());
+    put_json_str(f, "sn", adacom_sn());
+    fprintf(f, "\"channels\": %i}\n", adacom_num_channels());
+    fclose(f);
+}
+
+static void print_values(double *vals, int n)
+{
+    for (int ch = 0; ch < n; ch++) {
+        printf("%s%i=%.2f", ch > 0 ? " " : "", ch + 1, vals[ch]);
+    }
+    printf("\n");
+}
+
+static void set_all_cb(AdaComError err, double *vals, int n)
+{
+    if (err == ADACOM_OK) {
+        print_values(vals, n);
+        exit_code = 0;
+    } else {
+        fprintf(stderr, "Unable to set attenuations!\n");
+    }
+    mloop_stop();
+}
+
+static void apply_values(void)
+{
+    int n = adacom_num_channels();
+    double vals[n];
+    adacom_get_all(vals, n);
+    for (int i = 0; i < n_values; i++) {
+        if (channels[i] >= n) {
+            fprintf(stderr, "Invalid channel %i!\n", channels[i] + 1);
+            mloop_stop();
+            return;
+        }
+        vals[channels[i]] = values[i];
+    }
+    // Everything is sent in one set all sequence
+    if (adacom_set_all(vals, n, set_all_cb) != ADACOM_OK) {
+        fprintf(stderr, "Unable to set attenuations!\n");
+        mloop_stop();
+    } else if (!adacom_is_busy()) {
+        // All channels already had the requested values
+        set_all_cb(ADACOM_OK, vals, n);
+    }
+}
+
+static void connect_cb(AdaComError err)
+{
+    if (err != ADACOM_OK) {
+        if (cache_used) {
+            // The device might have been changed, try it without the cache.
+            log_debug("cli: Connecting with cached infos failed.");
+            cache_used = false;
+            adacom_disconnect();
+            if (adacom_connect(connect_cb) == ADACOM_OK)
+                return;
+        }
+        fprintf(stderr, "Unable to connect to '%s'!\n", cfg.ada.device);
+        mloop_stop();
+        return;
+    }
+    if (!cache_used) {
+        write_cache();
+    }
+    if (cmd == CLI_CMD_GET) {
+        int n = adacom_num_channels();
+        double vals[n];
+        adacom_get_all(vals, n);
+        print_values(vals, n);
+        exit_code = 0;
+        mloop_stop();
+    } else {
+        apply_values();
+    }
+}
+
+int cli_run(void)
+{
+    bool ok;
+    if (strcmp(cfg.cmd.name, "set") == 0) {
+        cmd = CLI_CMD_SET;
+        ok = parse_set_args();
+    } else if (strcmp(cfg.cmd.name, "preset") == 0) {
+        cmd = CLI_CMD_PRESET;
+        ok = parse_preset_args();
+    } else {
+        cmd = CLI_CMD_GET;
+        ok = cfg.cmd.argc == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Usage: adacon set CH=VALUE ... | get | preset NAME\n");
+        return 2;
+    }
+    adacom_init(cfg.ada.device);
+    Str *model = NULL, *sn = NULL;
+    int n;
+    AdaComError err;
+    if (read_cache(&model, &sn, &n)) {
+        cache_used = true;
+        err = adacom_connect_cached(model->cstr, sn->cstr, n, connect_cb);
+    } else {
+        err = adacom_connect(connect_cb);
+    }
+    delete(model);
+    delete(sn);
+    if (err == ADACOM_OK) {
+        mloop_run();
+    } else {
+        fprintf(stderr, "Unable to connect to '%s'!\n", cfg.ada.device);
+    }
+    adacom_destroy();
+    return exit_code;
+}
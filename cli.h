@@ -0,0 +1,6 @@
+#ifndef _CLI_H_
+#define _CLI_H_
+
+int cli_run(void);
+
+#endif /* _CLI_H_ */
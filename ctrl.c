@@ -0,0 +1,295 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <masc.h>
+
+#include "ctrl.h"
+
+
+static const char *cmd_names[] = {
+    [CTRL_CMD_SET] = "set",
+    [CTRL_CMD_GROUP] = "group",
+    [CTRL_CMD_VECTOR] = "vector",
+    [CTRL_CMD_HANDOFF] = "handoff",
+    [CTRL_CMD_STATE] = "state",
+};
+
+
+typedef struct {
+    Io io;
+    int fd;
+} CtrlClient;
+
+
+static char *sock_path = NULL;
+static Io server;
+static ctrl_request_cb request_cb = NULL;
+
+
+static CtrlCmd cmd_from_cstr(const char *name)
+{
+    for (int cmd = 0; cmd < CTRL_CMD_UNKNOWN; cmd++) {
+        if (strcmp(cmd_names[cmd], name) == 0)
+            return cmd;
+    }
+    return CTRL_CMD_UNKNOWN;
+}
+
+static bool add_value(CtrlRequest *req, int channel, double value)
+{
+    if (req->n >= ADACOM_MAX_CHANNELS)
+        return false;
+    req->channels[req->n] = channel;
+    req->values[req->n] = value;
+    req->n++;
+    return true;
+}
+
+static bool parse_clock(const char *name, CtrlRequest *req)
+{
+    if (strcmp(name, "realtime") == 0) {
+        req->realtime = true;
+    } else if (strcmp(name, "monotonic") == 0) {
+        req->realtime = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_handoff_args(List *args, CtrlRequest *req)
+{
+    int n_args = list_len(args) - 1;
+    if (n_args < 1 || n_args > 3)
+        return false;
+    Int *channel = str_to_int(list_get_at(args, 1), true);
+    bool ok = channel != NULL && add_value(req, channel->val - 1, 0);
+    delete(channel);
+    if (ok && n_args >= 2) {
+        Int *at = str_to_int(list_get_at(args, 2), true);
+        ok = at != NULL && at->val > 0;
+        req->at_ns = ok ? at->val : 0;
+        delete(at);
+    }
+    if (ok && n_args == 3) {
+        Str *clock = list_get_at(args, 3);
+        ok = parse_clock(clock->cstr, req);
+    }
+    return ok;
+}
+
+/*
+ * Line format: "set CH VALUE [CH VALUE ...]", "group CH VALUE",
+ * "vector VALUE ...", "handoff CH [AT_NS [monotonic|realtime]]" and "state"
+ */
+static bool parse_line(List *args, CtrlRequest *req)
+{
+    Str *name = list_get_at(args, 0);
+    req->cmd = cmd_from_cstr(name->cstr);
+    if (req->cmd == CTRL_CMD_HANDOFF) {
+        return parse_handoff_args(args, req);
+    }
+    int n_args = list_len(args) - 1;
+    bool ok = true;
+    for (int i = 1; i <= n_args && ok; i++) {
+        Str *arg = list_get_at(args, i);
+        if (req->cmd == CTRL_CMD_VECTOR) {
+            Double *value = str_to_double(arg, true);
+            ok = value != NULL && add_value(req, i - 1, value->val);
+            delete(value);
+        } else if (req->cmd == CTRL_CMD_SET || req->cmd == CTRL_CMD_GROUP) {
+            if (i + 1 > n_args)
+                return false;
+            Int *channel = str_to_int(arg, true);
+            Double *value = str_to_double(list_get_at(args, ++i), true);
+            ok = channel != NULL && value != NULL
+                    && add_value(req, channel->val - 1, value->val);
+            delete(value);
+            delete(channel);
+        }
+    }
+    return ok && req->cmd != CTRL_CMD_UNKNOWN;
+}
+
+/*
+ * JSON format: {"cmd": "set", "channel": 1, "value": 10.5},
+ * {"cmd": "vector", "values": [...]}, {"cmd": "handoff", "channel": 2,
+ * "at": NS, "clock": "realtime"}, ...
+ */
+static bool parse_json(Json *js, CtrlRequest *req)
+{
+    Object *cmd_obj = json_get_node(js, "cmd");
+    if (!isinstance(cmd_obj, Str))
+        return false;
+    req->cmd = cmd_from_cstr(((Str *)cmd_obj)->cstr);
+    Object *ch_obj = json_get_node(js, "channel");
+    Object *val_obj = json_get_node(js, "value");
+    Object *vals_obj = json_get_node(js, "values");
+    switch (req->cmd) {
+    case CTRL_CMD_SET:
+    case CTRL_CMD_GROUP:
+        if (!isinstance(ch_obj, Int) || !isinstance(val_obj, Num))
+            return false;
+        return add_value(req, int_get((Int *)ch_obj) - 1,
+                to_double((Num *)val_obj));
+    case CTRL_CMD_HANDOFF: {
+        Object *at_obj = json_get_node(js, "at");
+        Object *clock_obj = json_get_node(js, "clock");
+        if (!isinstance(ch_obj, Int))
+            return false;
+        if (isinstance(at_obj, Int) && int_get((Int *)at_obj) > 0) {
+            req->at_ns = int_get((Int *)at_obj);
+        } else if (!is_none(at_obj)) {
+            return false;
+        }
+        if (isinstance(clock_obj, Str)) {
+            if (!parse_clock(((Str *)clock_obj)->cstr, req))
+                return false;
+        } else if (!is_none(clock_obj)) {
+            return false;
+        }
+        return add_value(req, int_get((Int *)ch_obj) - 1, 0);
+    }
+    case CTRL_CMD_VECTOR: {
+        if (!isinstance(vals_obj, List))
+            return false;
+        bool ok = true;
+        Iter itr = init(Iter, vals_obj);
+        for (Num *v = next(&itr); v != NULL && ok; v = next(&itr)) {
+            ok = isinstance(v, Num) && add_value(req, req->n, to_double(v));
+        }
+        destroy(&itr);
+        return ok;
+    }
+    case CTRL_CMD_STATE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void client_line_cb(MlIoPkg *self, void *data, size_t size, void *arg)
+{
+    CtrlClient *client = arg;
+    Str line;
+    str_init_ncopy(&line, data, size);
+    str_strip(&line);
+    if (str_len(&line) == 0) {
+        destroy(&line);
+        return;
+    }
+    CtrlRequest req = { .cmd = CTRL_CMD_UNKNOWN, .n = 0, .at_ns = 0,
+            .realtime = false };
+    bool valid;
+    if (str_startswith(&line, "{")) {
+        Json *js = json_new_cstr(line.cstr);
+        valid = json_is_valid(js) && parse_json(js, &req);
+        delete(js);
+    } else {
+        List *args = str_split(&line, " ", -1);
+        valid = list_len(args) > 0 && parse_line(args, &req);
+        delete(args);
+    }
+    Str reply = init(Str, "");
+    bool ok = false;
+    if (!valid) {
+        log_warn("ctrl: Invalid request '%s'!", line.cstr);
+        str_append(&reply, "invalid request");
+    } else {
+        ok = request_cb(&req, &reply);
+    }
+    Str resp = init(Str, "%s%s%s\n", ok ? "ok" : "error",
+            str_len(&reply) > 0 ? " " : "", reply.cstr);
+    ssize_t ret = send(client->fd, resp.cstr, str_len(&resp), MSG_NOSIGNAL);
+    if (ret != (ssize_t)str_len(&resp)) {
+        // Close rather than leaving a partial reply, the EOF frees it
+        log_warn("ctrl: Unable to send the reply, closing client!");
+        shutdown(client->fd, SHUT_RDWR);
+    }
+    destroy(&resp);
+    destroy(&reply);
+    destroy(&line);
+}
+
+static void client_eof_cb(MlIoReader *self, void *arg)
+{
+    CtrlClient *client = arg;
+    log_debug("ctrl: Client disconnected.");
+    destroy(&client->io);
+    free(client);
+}
+
+static void server_cb(MlIo *self, int fd, ml_io_flag_t events, void *arg)
+{
+    if (!(events & ML_IO_READ))
+        return;
+    int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) {
+        log_warn("ctrl: Unable to accept client!");
+        return;
+    }
+    log_debug("ctrl: Client connected.");
+    CtrlClient *client = malloc(sizeof(CtrlClient));
+    client->io = init(Io, client_fd);
+    client->fd = client_fd;
+    mloop_io_pkg_new(&client->io, '\n', client_line_cb, client_eof_cb,
+            client);
+}
+
+static bool remove_stale_socket(const char *path)
+{
+    // Anything else at the path is left alone
+    struct stat st;
+    if (lstat(path, &st) < 0)
+        return errno == ENOENT;
+    return S_ISSOCK(st.st_mode) && unlink(path) == 0;
+}
+
+bool ctrl_init(const char *path, ctrl_request_cb req_cb)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_error("ctrl: Socket path '%s' is too long!", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_error("ctrl: Unable to create socket!");
+        return false;
+    }
+    server = init(Io, fd);
+    // Remove a stale socket of a previous run
+    if (!remove_stale_socket(path)) {
+        log_error("ctrl: '%s' exists and is not a stale socket!", path);
+        destroy(&server);
+        return false;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || listen(fd, 4) < 0) {
+        log_error("ctrl: Unable to listen on '%s'!", path);
+        destroy(&server);
+        return false;
+    }
+    sock_path = strdup(path);
+    request_cb = req_cb;
+    mloop_io_new(&server, ML_IO_READ, server_cb, NULL);
+    log_info("ctrl: Listening on '%s'.", path);
+    return true;
+}
+
+void ctrl_destroy(void)
+{
+    if (sock_path == NULL)
+        return;
+    destroy(&server);
+    unlink(sock_path);
+    free(sock_path);
+    sock_path = NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef _CTRL_H_
+#define _CTRL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <masc.h>
+
+#include "adacom.h"
+
+
+typedef enum {
+    CTRL_CMD_SET,
+    CTRL_CMD_GROUP,
+    CTRL_CMD_VECTOR,
+    CTRL_CMD_HANDOFF,
+    CTRL_CMD_STATE,
+    CTRL_CMD_UNKNOWN
+} CtrlCmd;
+
+typedef struct {
+    CtrlCmd cmd;
+    int n;
+    // Channel numbers start with 0 (clients use 1 based numbers)
+    int channels[ADACOM_MAX_CHANNELS];
+    double values[ADACOM_MAX_CHANNELS];
+    // Absolute start instant of a handoff in ns (0 means immediately)
+    uint64_t at_ns;
+    bool realtime;
+} CtrlRequest;
+
+/*
+ * The request callback returns true on success. The reply string may be
+ * extended by the callback, e.g. with the state or an error message.
+ */
+typedef bool (*ctrl_request_cb)(const CtrlRequest *req, Str *reply);
+
+
+bool ctrl_init(const char *path, ctrl_request_cb req_cb);
+void ctrl_destroy(void);
+
+#endif /* _CTRL_H_ */
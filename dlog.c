@@ -0,0 +1,188 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "dlog.h"
+
+// Size of a single formatted message
+#define DLOG_LINE_SIZE 256
+
+
+typedef struct {
+    uint64_t ts_ns;
+    const char *fmt;
+    int n;
+    DlogArg args[DLOG_MAX_ARGS];
+    // Copies of the string arguments
+    char str[DLOG_STR_SIZE];
+} DlogRecord;
+
+
+int dlog_level = LOG_INFO;
+bool dlog_lazy = false;
+
+static DlogRecord ring[DLOG_RING_SIZE];
+static unsigned int head = 0;
+static unsigned int tail = 0;
+static unsigned long dropped = 0;
+static MlTimer *flush_timer = NULL;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void flush_timer_cb(MlTimer *timer, void *arg)
+{
+    ml_timer_add(flush_timer, DLOG_FLUSH_INTERVAL);
+    dlog_flush();
+}
+
+void dlog_init(int level, bool lazy)
+{
+    dlog_level = level;
+    dlog_lazy = lazy;
+    head = tail = 0;
+    dropped = 0;
+#ifdef LOG_DEBUG_ENABLED
+    if (dlog_lazy && dlog_level >= LOG_DEBUG) {
+        flush_timer = new(MlTimer, flush_timer_cb, NULL);
+        ml_timer_in(flush_timer, DLOG_FLUSH_INTERVAL);
+    }
+#endif
+}
+
+void dlog_record(const char *fmt, int n, const DlogArg *args)
+{
+    if (head - tail >= DLOG_RING_SIZE) {
+        dropped++;
+        return;
+    }
+    DlogRecord *rec = &ring[head % DLOG_RING_SIZE];
+    rec->ts_ns = now_ns();
+    rec->fmt = fmt;
+    rec->n = n;
+    size_t used = 0;
+    for (int i = 0; i < n; i++) {
+        rec->args[i] = args[i];
+        if (args[i].type != DLOG_ARG_STR)
+            continue;
+        // Strings do not outlive the call, copy them (truncated if needed)
+        char *s = rec->str + used;
+        size_t avail = used < DLOG_STR_SIZE ? DLOG_STR_SIZE - used : 0;
+        if (avail == 0 || args[i].s == NULL) {
+            rec->args[i].s = "";
+            continue;
+        }
+        snprintf(s, avail, "%s", args[i].s);
+        rec->args[i].s = s;
+        used += strlen(s) + 1;
+    }
+    head++;
+}
+
+static size_t format_arg(char *out, size_t size, const char *spec,
+        size_t spec_len, const DlogArg *arg)
+{
+    char conv = spec[spec_len - 1];
+    // Drop the length modifiers, the stored integers are long long
+    char fmt[32];
+    size_t len = 0;
+    for (size_t i = 0; i < spec_len - 1 && len < sizeof(fmt) - 4; i++) {
+        if (strchr("hlLqjzt", spec[i]) == NULL) {
+            fmt[len++] = spec[i];
+        }
+    }
+    int ret;
+    if (conv == 's') {
+        fmt[len++] = 's';
+        fmt[len] = '\0';
+        ret = snprintf(out, size, fmt, arg->type == DLOG_ARG_STR ? arg->s : "?");
+    } else if (strchr("feEgGaA", conv) != NULL) {
+        fmt[len++] = conv;
+        fmt[len] = '\0';
+        double d = arg->type == DLOG_ARG_DOUBLE ? arg->d : arg->i;
+        ret = snprintf(out, size, fmt, arg->type == DLOG_ARG_STR ? 0 : d);
+    } else if (strchr("diouxXc", conv) != NULL) {
+        if (conv != 'c') {
+            fmt[len++] = 'l';
+            fmt[len++] = 'l';
+        }
+        fmt[len++] = conv;
+        fmt[len] = '\0';
+        long long i = arg->type == DLOG_ARG_DOUBLE ? arg->d : arg->i;
+        if (conv == 'c') {
+            ret = snprintf(out, size, fmt, (int)i);
+        } else {
+            ret = snprintf(out, size, fmt, arg->type == DLOG_ARG_STR ? 0 : i);
+        }
+    } else {
+        // Unsupported conversion (e.g. masc objects)
+        ret = snprintf(out, size, "?");
+    }
+    if (ret < 0)
+        return 0;
+    return (size_t)ret < size ? (size_t)ret : size - 1;
+}
+
+static void format_record(const DlogRecord *rec, char *out, size_t size)
+{
+    const char *p = rec->fmt;
+    size_t len = 0;
+    int arg = 0;
+    while (*p != '\0' && len < size - 1) {
+        if (*p != '%') {
+            out[len++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[len++] = '%';
+            p += 2;
+            continue;
+        }
+        // Conversion specification up to its conversion character
+        size_t spec_len = 1;
+        while (p[spec_len] != '\0'
+                && strchr("diouxXcsfeEgGaApnO", p[spec_len]) == NULL) {
+            spec_len++;
+        }
+        if (p[spec_len] == '\0' || arg >= rec->n)
+            break;
+        spec_len++;
+        len += format_arg(out + len, size - len, p, spec_len, &rec->args[arg++]);
+        p += spec_len;
+    }
+    out[len] = '\0';
+}
+
+void dlog_flush(void)
+{
+    if (head == tail && dropped == 0)
+        return;
+    uint64_t now = now_ns();
+    char line[DLOG_LINE_SIZE];
+    while (tail != head) {
+        const DlogRecord *rec = &ring[tail % DLOG_RING_SIZE];
+        format_record(rec, line, sizeof(line));
+        // Keep the original instant visible, the log stamps the flush
+        log_debug("%s [-%.1f ms]", line, (now - rec->ts_ns) / 1000000.0);
+        tail++;
+    }
+    if (dropped > 0) {
+        log_warn("dlog: %lu debug messages have been dropped!", dropped);
+        dropped = 0;
+    }
+}
+
+void dlog_destroy(void)
+{
+    if (flush_timer != NULL) {
+        delete(flush_timer);
+        flush_timer = NULL;
+    }
+    dlog_flush();
+}
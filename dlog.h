@@ -0,0 +1,105 @@
+#ifndef _DLOG_H_
+#define _DLOG_H_
+
+#include <stdbool.h>
+#include <masc.h>
+
+/*
+ * Debug logging for the hot paths (commands, serial lines, player ticks).
+ *
+ * dlog_debug() checks the log level before its arguments are evaluated and
+ * vanishes completely if LOG_DEBUG_ENABLED is not set at compile time. In
+ * lazy mode only the format string and the raw arguments (integers, doubles
+ * and strings) are stored in a ring buffer, which is formatted and passed on
+ * to the log from a timer. Only use it from the main loop thread.
+ */
+
+#define DLOG_MAX_ARGS 4
+#define DLOG_STR_SIZE 96
+#define DLOG_RING_SIZE 1024
+// Interval in ms the lazy records are formatted
+#define DLOG_FLUSH_INTERVAL 200
+
+
+typedef enum {
+    DLOG_ARG_INT,
+    DLOG_ARG_DOUBLE,
+    DLOG_ARG_STR
+} DlogArgType;
+
+typedef struct {
+    DlogArgType type;
+    union {
+        long long i;
+        double d;
+        const char *s;
+    };
+} DlogArg;
+
+
+extern int dlog_level;
+extern bool dlog_lazy;
+
+
+void dlog_init(int level, bool lazy);
+void dlog_flush(void);
+void dlog_destroy(void);
+
+void dlog_record(const char *fmt, int n, const DlogArg *args);
+
+static inline DlogArg dlog_arg_int(long long i)
+{
+    return (DlogArg){ .type = DLOG_ARG_INT, .i = i };
+}
+
+static inline DlogArg dlog_arg_double(double d)
+{
+    return (DlogArg){ .type = DLOG_ARG_DOUBLE, .d = d };
+}
+
+static inline DlogArg dlog_arg_str(const char *s)
+{
+    return (DlogArg){ .type = DLOG_ARG_STR, .s = s };
+}
+
+#define DLOG_ARG(x) _Generic((x), \
+        char *: dlog_arg_str, \
+        const char *: dlog_arg_str, \
+        float: dlog_arg_double, \
+        double: dlog_arg_double, \
+        default: dlog_arg_int)(x)
+
+// Apply DLOG_ARG to up to DLOG_MAX_ARGS arguments
+#define DLOG_NARGS(...) DLOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, n, ...) n
+#define DLOG_CAT(a, b) DLOG_CAT_(a, b)
+#define DLOG_CAT_(a, b) a##b
+#define DLOG_ARGS_0()
+#define DLOG_ARGS_1(a) DLOG_ARG(a)
+#define DLOG_ARGS_2(a, b) DLOG_ARG(a), DLOG_ARG(b)
+#define DLOG_ARGS_3(a, b, c) DLOG_ARG(a), DLOG_ARG(b), DLOG_ARG(c)
+#define DLOG_ARGS_4(a, b, c, d) DLOG_ARG(a), DLOG_ARG(b), DLOG_ARG(c), \
+        DLOG_ARG(d)
+#define DLOG_ARGS(...) DLOG_CAT(DLOG_ARGS_, DLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+#ifdef LOG_DEBUG_ENABLED
+#define dlog_debug(fmt, ...) do { \
+    if (dlog_level >= LOG_DEBUG) { \
+        if (dlog_lazy) { \
+            dlog_record(fmt, DLOG_NARGS(__VA_ARGS__), \
+                    (DlogArg[DLOG_MAX_ARGS]){ DLOG_ARGS(__VA_ARGS__) }); \
+        } else { \
+            log_debug(fmt, ##__VA_ARGS__); \
+        } \
+    } \
+} while (0)
+#else
+// Never executed, but the arguments still count as used
+#define dlog_debug(fmt, ...) do { \
+    if (0) { \
+        log_debug(fmt, ##__VA_ARGS__); \
+    } \
+} while (0)
+#endif
+
+#endif /* _DLOG_H_ */
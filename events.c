@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <masc.h>
+
+#include "events.h"
+
+
+typedef struct {
+    Io io;
+    int fd;
+} EventsSub;
+
+
+static char *sock_path = NULL;
+static Io server;
+static EventsSub *subscribers[EVENTS_MAX_SUBSCRIBERS];
+static int n_subscribers = 0;
+
+
+static void delete_subscriber(EventsSub *sub)
+{
+    destroy(&sub->io);
+    free(sub);
+}
+
+static void remove_subscriber(EventsSub *sub)
+{
+    for (int i = 0; i < n_subscribers; i++) {
+        if (subscribers[i] == sub) {
+            subscribers[i] = subscribers[--n_subscribers];
+            break;
+        }
+    }
+    delete_subscriber(sub);
+}
+
+static void sub_line_cb(MlIoPkg *self, void *data, size_t size, void *arg)
+{
+    // Subscribers are not expected to send anything, ignore it.
+}
+
+static void sub_eof_cb(MlIoReader *self, void *arg)
+{
+    log_debug("events: Subscriber disconnected.");
+    remove_subscriber(arg);
+}
+
+static void server_cb(MlIo *self, int fd, ml_io_flag_t events, void *arg)
+{
+    if (!(events & ML_IO_READ))
+        return;
+    int sub_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (sub_fd < 0) {
+        log_warn("events: Unable to accept subscriber!");
+        return;
+    }
+    if (n_subscribers >= EVENTS_MAX_SUBSCRIBERS) {
+        log_warn("events: Too many subscribers!");
+        close(sub_fd);
+        return;
+    }
+    EventsSub *sub = malloc(sizeof(EventsSub));
+    sub->io = init(Io, sub_fd);
+    sub->fd = sub_fd;
+    log_debug("events: Subscriber connected.");
+    subscribers[n_subscribers++] = sub;
+    mloop_io_pkg_new(&sub->io, '\n', sub_line_cb, sub_eof_cb, sub);
+}
+
+static bool remove_stale_socket(const char *path)
+{
+    // Anything else at the path is left alone
+    struct stat st;
+    if (lstat(path, &st) < 0)
+        return errno == ENOENT;
+    return S_ISSOCK(st.st_mode) && unlink(path) == 0;
+}
+
+bool events_init(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_error("events: Socket path '%s' is too long!", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_error("events: Unable to create socket!");
+        return false;
+    }
+    server = init(Io, fd);
+    // Remove a stale socket of a previous run
+    if (!remove_stale_socket(path)) {
+        log_error("events: '%s' exists and is not a stale socket!", path);
+        destroy(&server);
+        return false;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || listen(fd, 4) < 0) {
+        log_error("events: Unable to listen on '%s'!", path);
+        destroy(&server);
+        return false;
+    }
+    sock_path = strdup(path);
+    mloop_io_new(&server, ML_IO_READ, server_cb, NULL);
+    log_info("events: Publishing changes on '%s'.", path);
+    return true;
+}
+
+void events_destroy(void)
+{
+    if (sock_path == NULL)
+        return;
+    while (n_subscribers > 0) {
+        delete_subscriber(subscribers[--n_subscribers]);
+    }
+    destroy(&server);
+    unlink(sock_path);
+    free(sock_path);
+    sock_path = NULL;
+}
+
+void events_emit(int ch, double value, uint64_t req_ns, uint64_t applied_ns)
+{
+    if (n_subscribers == 0)
+        return;
+    // One line per change: channel, value, request and applied time in ns
+    char rec[80];
+    int size = snprintf(rec, sizeof(rec), "%i %.2f %llu %llu\n", ch + 1,
+            value, (unsigned long long)req_ns,
+            (unsigned long long)applied_ns);
+    for (int i = n_subscribers - 1; i >= 0; i--) {
+        // A subscriber which is too slow (or gone) is dropped instead of
+        // blocking adacon or receiving a partial record.
+        ssize_t ret = send(subscribers[i]->fd, rec, size, MSG_NOSIGNAL);
+        if (ret != size) {
+            log_warn("events: Dropped a subscriber which did not keep up!");
+            remove_subscriber(subscribers[i]);
+        }
+    }
+}
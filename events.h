@@ -0,0 +1,15 @@
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EVENTS_MAX_SUBSCRIBERS 16
+
+
+bool events_init(const char *path);
+void events_destroy(void);
+
+void events_emit(int ch, double value, uint64_t req_ns, uint64_t applied_ns);
+
+#endif /* _EVENTS_H_ */
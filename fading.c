@@ -0,0 +1,81 @@
+#include <math.h>
+
+#include "fading.h"
+
+
+// Generator of a channel, the process is advanced tick by tick
+typedef struct {
+    uint64_t prng_state;
+    long tick;
+    double x;
+} FadingGen;
+
+static FadingGen gens[ADACOM_MAX_CHANNELS];
+static uint64_t base_seed;
+static double sigma_db;
+static double a;
+static double b;
+
+
+/* SplitMix64, small and good enough for reproducible shadowing */
+static uint64_t prng_next(FadingGen *gen)
+{
+    uint64_t z = (gen->prng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double prng_uniform(FadingGen *gen)
+{
+    // Uniform in (0, 1]
+    return ((prng_next(gen) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static double prng_gauss(FadingGen *gen)
+{
+    // Box-Muller transform
+    return sqrt(-2 * log(prng_uniform(gen)))
+            * cos(2 * M_PI * prng_uniform(gen));
+}
+
+static void reset_gen(int ch)
+{
+    FadingGen *gen = &gens[ch];
+    gen->prng_state = base_seed + ch;
+    gen->tick = 0;
+    gen->x = sigma_db * prng_gauss(gen);
+}
+
+bool fading_init(uint64_t seed, double sigma, int corr_time, int tick_time)
+{
+    if (sigma < 0 || corr_time <= 0 || tick_time <= 0)
+        return false;
+    // Log-normal shadowing is a Gaussian process in dB, generated as a first
+    // order autoregressive process with the given correlation time.
+    base_seed = seed;
+    sigma_db = sigma;
+    a = exp(-(double)tick_time / corr_time);
+    b = sigma * sqrt(1 - a * a);
+    for (int ch = 0; ch < ADACOM_MAX_CHANNELS; ch++) {
+        reset_gen(ch);
+    }
+    return true;
+}
+
+double fading_offset(int ch, long tick)
+{
+    if (ch < 0 || ch >= ADACOM_MAX_CHANNELS || tick < 0)
+        return 0;
+    FadingGen *gen = &gens[ch];
+    // A restarted sequence is generated again from its start
+    if (tick < gen->tick) {
+        reset_gen(ch);
+    }
+    // Each tick takes one sample, so the sequence only depends on the seed
+    while (gen->tick < tick) {
+        gen->x = a * gen->x + b * prng_gauss(gen);
+        gen->tick++;
+    }
+    return gen->x;
+}
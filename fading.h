@@ -0,0 +1,14 @@
+#ifndef _FADING_H_
+#define _FADING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "adacom.h"
+
+
+bool fading_init(uint64_t seed, double sigma, int corr_time, int tick_time);
+// Offset in dB of a channel, which is cheap for increasing ticks
+double fading_offset(int ch, long tick);
+
+#endif /* _FADING_H_ */
@@ -0,0 +1,76 @@
+#include <string.h>
+
+#include "hist.h"
+
+
+static int value_to_index(uint64_t value)
+{
+    if (value >= (uint64_t)1 << HIST_MAX_BITS) {
+        return HIST_SIZE - 1;
+    }
+    // The first bucket is linear, all others only use their upper half.
+    int msb = value > 0 ? 63 - __builtin_clzll(value) : 0;
+    int bucket = msb > HIST_SUB_BITS ? msb - HIST_SUB_BITS : 0;
+    return bucket * HIST_SUB_HALF + (int)(value >> bucket);
+}
+
+static uint64_t index_to_value(int idx)
+{
+    int bucket = idx < 2 * HIST_SUB_HALF ? 0 : idx / HIST_SUB_HALF - 1;
+    uint64_t sub = idx - bucket * HIST_SUB_HALF;
+    // Return the highest value which is equivalent to the index
+    return (sub << bucket) + ((uint64_t)1 << bucket) - 1;
+}
+
+void hist_reset(Hist *self)
+{
+    memset(self, 0, sizeof(Hist));
+}
+
+void hist_record(Hist *self, uint64_t value)
+{
+    if (self->count == 0 || value < self->min) {
+        self->min = value;
+    }
+    if (value > self->max) {
+        self->max = value;
+    }
+    self->count++;
+    self->sum += value;
+    self->counts[value_to_index(value)]++;
+}
+
+double hist_mean(const Hist *self)
+{
+    return self->count > 0 ? self->sum / self->count : 0;
+}
+
+uint64_t hist_percentile(const Hist *self, double percentile)
+{
+    if (self->count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(percentile / 100 * self->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int idx = 0; idx < HIST_SIZE; idx++) {
+        seen += self->counts[idx];
+        if (seen >= rank) {
+            uint64_t value = index_to_value(idx);
+            return value < self->max ? value : self->max;
+        }
+    }
+    return self->max;
+}
+
+uint64_t hist_count_le(const Hist *self, uint64_t value)
+{
+    // Buckets are only counted completely, so this is exact at the bucket
+    // boundaries and otherwise within the resolution of the histogram.
+    uint64_t count = 0;
+    for (int idx = 0; idx < HIST_SIZE && index_to_value(idx) <= value; idx++) {
+        count += self->counts[idx];
+    }
+    return count;
+}
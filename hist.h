@@ -0,0 +1,31 @@
+#ifndef _HIST_H_
+#define _HIST_H_
+
+#include <stdint.h>
+
+// Log-linear (HDR style) histogram with 2^HIST_SUB_BITS sub-buckets per power
+// of two, i.e. a relative resolution of about 3%, for values up to 2^32.
+#define HIST_SUB_BITS 5
+#define HIST_SUB_HALF (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 32
+#define HIST_SIZE ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_HALF)
+
+
+typedef struct {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+    uint32_t counts[HIST_SIZE];
+} Hist;
+
+
+void hist_reset(Hist *self);
+void hist_record(Hist *self, uint64_t value);
+
+double hist_mean(const Hist *self);
+uint64_t hist_percentile(const Hist *self, double percentile);
+// Number of recorded values less than or equal to value
+uint64_t hist_count_le(const Hist *self, uint64_t value);
+
+#endif /* _HIST_H_ */
@@ -0,0 +1,307 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+// The header is padded to keep the areas aligned
+#define JOURNAL_HEADER_SIZE 64
+#define JOURNAL_FILE_SIZE (JOURNAL_HEADER_SIZE + 2 * JOURNAL_AREA_SIZE)
+
+
+typedef enum {
+    JOURNAL_REC_DEVICE = 1,
+    JOURNAL_REC_REQUESTED,
+    JOURNAL_REC_APPLIED,
+    JOURNAL_REC_PLAYER
+} JournalRecType;
+
+typedef struct {
+    // Size of the complete record (multiple of 8), 0: end of the journal
+    atomic_uint size;
+    uint32_t type;
+    uint64_t seq;
+    // Of the type, the sequence number and the (padded) payload
+    uint32_t crc;
+    uint32_t reserved;
+} JournalRec;
+
+typedef struct {
+    char model[JOURNAL_ID_SIZE];
+    char sn[JOURNAL_ID_SIZE];
+    int32_t num_channels;
+    int32_t reserved;
+} JournalDevice;
+
+typedef struct {
+    int32_t first;
+    int32_t n;
+    double values[];
+} JournalVector;
+
+
+static uint8_t *base = NULL;
+static JournalHeader *header = NULL;
+// Write position in the active area
+static size_t used = 0;
+static uint64_t seq = 0;
+// Current state, which is written as snapshot on compaction
+static JournalState cur;
+
+
+static uint8_t *get_area(unsigned int idx)
+{
+    return base + JOURNAL_HEADER_SIZE + idx * JOURNAL_AREA_SIZE;
+}
+
+static uint32_t crc32(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t rec_crc(const JournalRec *rec, size_t len)
+{
+    uint32_t crc = crc32(0, &rec->type, sizeof(rec->type));
+    crc = crc32(crc, &rec->seq, sizeof(rec->seq));
+    return crc32(crc, rec + 1, len);
+}
+
+static bool put_rec(uint8_t *area, JournalRecType type, const void *payload,
+        size_t len)
+{
+    size_t size = (sizeof(JournalRec) + len + 7) & ~(size_t)7;
+    if (used + size > JOURNAL_AREA_SIZE)
+        return false;
+    JournalRec *rec = (JournalRec *)(area + used);
+    rec->type = type;
+    rec->seq = ++seq;
+    rec->reserved = 0;
+    memcpy(rec + 1, payload, len);
+    memset((uint8_t *)(rec + 1) + len, 0, size - sizeof(JournalRec) - len);
+    rec->crc = rec_crc(rec, size - sizeof(JournalRec));
+    // The record only becomes visible when it is complete
+    atomic_store_explicit(&rec->size, size, memory_order_release);
+    used += size;
+    return true;
+}
+
+static size_t fill_vector(JournalVector *vec, int first,
+        const double *values, int n)
+{
+    vec->first = first;
+    vec->n = n;
+    memcpy(vec->values, values, n * sizeof(double));
+    return sizeof(JournalVector) + n * sizeof(double);
+}
+
+static void put_vector(uint8_t *area, JournalRecType type, int first,
+        const double *values, int n)
+{
+    // Header (first and n) plus the values, aligned for the doubles
+    double buf[1 + ADACOM_MAX_CHANNELS];
+    size_t len = fill_vector((JournalVector *)buf, first, values, n);
+    put_rec(area, type, buf, len);
+}
+
+static void put_snapshot(uint8_t *area)
+{
+    if (cur.has_device) {
+        JournalDevice dev = { .num_channels = cur.num_channels };
+        memcpy(dev.model, cur.model, JOURNAL_ID_SIZE);
+        memcpy(dev.sn, cur.sn, JOURNAL_ID_SIZE);
+        put_rec(area, JOURNAL_REC_DEVICE, &dev, sizeof(dev));
+        if (cur.has_applied) {
+            put_vector(area, JOURNAL_REC_APPLIED, 0, cur.applied,
+                    cur.num_channels);
+        }
+    }
+    if (cur.has_requested) {
+        put_vector(area, JOURNAL_REC_REQUESTED, 0, cur.requested,
+                cur.num_channels);
+    }
+    put_rec(area, JOURNAL_REC_PLAYER, &cur.player, sizeof(cur.player));
+}
+
+static void compact(void)
+{
+    unsigned int next = !atomic_load_explicit(&header->active,
+            memory_order_relaxed);
+    uint8_t *area = get_area(next);
+    memset(area, 0, JOURNAL_AREA_SIZE);
+    used = 0;
+    put_snapshot(area);
+    // Until this store a crash restores from the previous area
+    atomic_store_explicit(&header->active, next, memory_order_release);
+    msync(base, JOURNAL_FILE_SIZE, MS_ASYNC);
+}
+
+static void append(JournalRecType type, const void *payload, size_t len)
+{
+    unsigned int active = atomic_load_explicit(&header->active,
+            memory_order_relaxed);
+    // The snapshot of a compaction already contains the change
+    if (!put_rec(get_area(active), type, payload, len)) {
+        compact();
+    }
+}
+
+static void append_vector(JournalRecType type, int first,
+        const double *values, int n)
+{
+    // Header (first and n) plus the values, aligned for the doubles
+    double buf[1 + ADACOM_MAX_CHANNELS];
+    size_t len = fill_vector((JournalVector *)buf, first, values, n);
+    append(type, buf, len);
+}
+
+static void restore_vector(const JournalVector *vec, size_t len,
+        double *values, bool *complete)
+{
+    if (len < sizeof(JournalVector) || vec->first < 0 || vec->n < 0
+            || vec->first + vec->n > ADACOM_MAX_CHANNELS
+            || len < sizeof(JournalVector) + vec->n * sizeof(double))
+        return;
+    memcpy(values + vec->first, vec->values, vec->n * sizeof(double));
+    if (vec->first == 0 && vec->n == cur.num_channels) {
+        *complete = true;
+    }
+}
+
+static void restore_rec(JournalRecType type, const void *payload, size_t len)
+{
+    if (type == JOURNAL_REC_DEVICE && len >= sizeof(JournalDevice)) {
+        const JournalDevice *dev = payload;
+        if (dev->num_channels <= 0 || dev->num_channels > ADACOM_MAX_CHANNELS)
+            return;
+        memcpy(cur.model, dev->model, JOURNAL_ID_SIZE);
+        cur.model[JOURNAL_ID_SIZE - 1] = '\0';
+        memcpy(cur.sn, dev->sn, JOURNAL_ID_SIZE);
+        cur.sn[JOURNAL_ID_SIZE - 1] = '\0';
+        cur.num_channels = dev->num_channels;
+        cur.has_device = true;
+        // Followed by the values of the (re)connect
+        cur.has_applied = false;
+    } else if (type == JOURNAL_REC_REQUESTED) {
+        restore_vector(payload, len, cur.requested, &cur.has_requested);
+    } else if (type == JOURNAL_REC_APPLIED) {
+        restore_vector(payload, len, cur.applied, &cur.has_applied);
+    } else if (type == JOURNAL_REC_PLAYER && len >= sizeof(JournalPlayer)) {
+        memcpy(&cur.player, payload, sizeof(JournalPlayer));
+    }
+}
+
+static void restore(uint8_t *area)
+{
+    size_t pos = 0;
+    while (pos + sizeof(JournalRec) <= JOURNAL_AREA_SIZE) {
+        JournalRec *rec = (JournalRec *)(area + pos);
+        size_t size = atomic_load_explicit(&rec->size, memory_order_acquire);
+        // The end of the journal or a torn record
+        if (size < sizeof(JournalRec) || size % 8 != 0
+                || pos + size > JOURNAL_AREA_SIZE)
+            break;
+        size_t len = size - sizeof(JournalRec);
+        if (rec->crc != rec_crc(rec, len) || rec->seq <= seq)
+            break;
+        restore_rec(rec->type, rec + 1, len);
+        seq = rec->seq;
+        pos += size;
+    }
+}
+
+bool journal_open(const char *path, JournalState *restored)
+{
+    memset(restored, 0, sizeof(JournalState));
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, JOURNAL_FILE_SIZE) < 0) {
+        close(fd);
+        return false;
+    }
+    void *addr = mmap(NULL, JOURNAL_FILE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+    base = addr;
+    header = addr;
+    memset(&cur, 0, sizeof(cur));
+    seq = 0;
+    if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION) {
+        memset(base, 0, JOURNAL_FILE_SIZE);
+        header->version = JOURNAL_VERSION;
+        atomic_thread_fence(memory_order_release);
+        header->magic = JOURNAL_MAGIC;
+    } else {
+        restore(get_area(atomic_load_explicit(&header->active,
+                memory_order_acquire) & 1));
+        memcpy(restored, &cur, sizeof(JournalState));
+    }
+    // Start with a clean area, i.e. without a torn tail
+    compact();
+    return true;
+}
+
+void journal_close(void)
+{
+    if (base == NULL)
+        return;
+    msync(base, JOURNAL_FILE_SIZE, MS_SYNC);
+    munmap(base, JOURNAL_FILE_SIZE);
+    base = NULL;
+    header = NULL;
+}
+
+void journal_device(const char *model, const char *sn, int n,
+        const double *values)
+{
+    if (base == NULL || n <= 0 || n > ADACOM_MAX_CHANNELS)
+        return;
+    JournalDevice dev = { .num_channels = n };
+    strncpy(dev.model, model, JOURNAL_ID_SIZE - 1);
+    strncpy(dev.sn, sn, JOURNAL_ID_SIZE - 1);
+    memcpy(cur.model, dev.model, JOURNAL_ID_SIZE);
+    memcpy(cur.sn, dev.sn, JOURNAL_ID_SIZE);
+    cur.num_channels = n;
+    cur.has_device = true;
+    memcpy(cur.applied, values, n * sizeof(double));
+    cur.has_applied = true;
+    append(JOURNAL_REC_DEVICE, &dev, sizeof(dev));
+    append_vector(JOURNAL_REC_APPLIED, 0, values, n);
+}
+
+void journal_requested(const double *values, int n)
+{
+    if (base == NULL || n <= 0 || n > ADACOM_MAX_CHANNELS)
+        return;
+    memcpy(cur.requested, values, n * sizeof(double));
+    cur.has_requested = true;
+    append_vector(JOURNAL_REC_REQUESTED, 0, values, n);
+}
+
+void journal_applied(int ch, double value)
+{
+    if (base == NULL || ch < 0 || ch >= ADACOM_MAX_CHANNELS)
+        return;
+    cur.applied[ch] = value;
+    append_vector(JOURNAL_REC_APPLIED, ch, &value, 1);
+}
+
+void journal_player(const JournalPlayer *player)
+{
+    if (base == NULL || memcmp(player, &cur.player, sizeof(JournalPlayer)) == 0)
+        return;
+    memcpy(&cur.player, player, sizeof(JournalPlayer));
+    append(JOURNAL_REC_PLAYER, player, sizeof(JournalPlayer));
+}
@@ -0,0 +1,68 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "adacom.h"
+
+#define JOURNAL_MAGIC 0x4144414a
+#define JOURNAL_VERSION 1
+#define JOURNAL_ID_SIZE 32
+// Size of each of the two record areas
+#define JOURNAL_AREA_SIZE (64 * 1024)
+
+/*
+ * Crash-safe journal of the requested and applied attenuations and of the
+ * player state, which lives in a memory mapped file (i.e. it survives a
+ * crash of adacon without any syscall on the hot path).
+ *
+ * The records are appended to the active one of two areas. A record becomes
+ * visible by the store of its size after its content, a record with a
+ * mismatching crc ends the journal as well. A full area is compacted into a
+ * snapshot in the other area, which then is activated by a single store.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    atomic_uint active;
+    uint32_t reserved;
+} JournalHeader;
+
+typedef struct {
+    // State of the player (AdaConState of main) and its channel
+    int32_t state;
+    int32_t channel;
+    // Time in ms the playback has been running
+    int32_t elapsed;
+    int32_t reserved;
+} JournalPlayer;
+
+typedef struct {
+    bool has_device;
+    char model[JOURNAL_ID_SIZE];
+    char sn[JOURNAL_ID_SIZE];
+    int num_channels;
+    // Last values which have been requested from the device
+    bool has_requested;
+    double requested[ADACOM_MAX_CHANNELS];
+    // Values the device has confirmed since the last connect
+    bool has_applied;
+    double applied[ADACOM_MAX_CHANNELS];
+    JournalPlayer player;
+} JournalState;
+
+
+// Maps the journal and restores its last state (zeroed if there is none)
+bool journal_open(const char *path, JournalState *restored);
+void journal_close(void);
+
+void journal_device(const char *model, const char *sn, int n,
+        const double *values);
+void journal_requested(const double *values, int n);
+void journal_applied(int ch, double value);
+// Only appended if the player state has changed
+void journal_player(const JournalPlayer *player);
+
+#endif /* _JOURNAL_H_ */
@@ -0,0 +1,366 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <masc.h>
+
+#include "libadacom.h"
+
+
+typedef enum {
+    LIBADACOM_CMD_CONNECT,
+    LIBADACOM_CMD_SET_ALL,
+    LIBADACOM_CMD_SET_CHANNEL
+} LibAdaComCmdType;
+
+typedef struct {
+    LibAdaComCmdType type;
+    int ch;
+    int n;
+    double values[ADACOM_MAX_CHANNELS];
+} LibAdaComCmd;
+
+// Single producer, single consumer rings
+typedef struct {
+    LibAdaComCmd slots[LIBADACOM_SLOTS];
+    atomic_size_t head;
+    atomic_size_t tail;
+} CmdRing;
+
+typedef struct {
+    LibAdaComEvent slots[LIBADACOM_SLOTS];
+    atomic_size_t head;
+    atomic_size_t tail;
+} EventRing;
+
+
+static char *device = NULL;
+// Wakes up the device thread for new commands
+static int wake_fd = -1;
+// Readable for the application while events are pending
+static int notify_fd = -1;
+static pthread_t thread;
+static atomic_bool running = false;
+static atomic_ulong dropped = 0;
+// Application -> device thread, device thread -> application
+static CmdRing cmds;
+static EventRing events;
+// State of the device thread
+static Io wake_io;
+static double desired[ADACOM_MAX_CHANNELS];
+static bool desired_pending = false;
+
+
+static bool ring_can_push(atomic_size_t *head, atomic_size_t *tail, size_t *h)
+{
+    *h = atomic_load_explicit(head, memory_order_relaxed);
+    size_t t = atomic_load_explicit(tail, memory_order_acquire);
+    return *h - t < LIBADACOM_SLOTS;
+}
+
+static bool ring_can_pop(atomic_size_t *head, atomic_size_t *tail, size_t *t)
+{
+    *t = atomic_load_explicit(tail, memory_order_relaxed);
+    size_t h = atomic_load_explicit(head, memory_order_acquire);
+    return *t != h;
+}
+
+static void signal_fd(int efd)
+{
+    // masc defines its own write()
+    while (eventfd_write(efd, 1) < 0 && errno == EINTR);
+}
+
+/*
+ * Device thread
+ */
+static void push_event(const LibAdaComEvent *event)
+{
+    size_t h;
+    if (!ring_can_push(&events.head, &events.tail, &h)) {
+        atomic_fetch_add(&dropped, 1);
+        return;
+    }
+    events.slots[h & (LIBADACOM_SLOTS - 1)] = *event;
+    atomic_store_explicit(&events.head, h + 1, memory_order_release);
+    signal_fd(notify_fd);
+}
+
+static void push_set_all(AdaComError err, const double *values, int n)
+{
+    LibAdaComEvent event = {
+        .type = LIBADACOM_EVT_SET_ALL,
+        .err = err,
+        .state = adacom_state(),
+        .ch = -1,
+        .num_channels = n
+    };
+    memcpy(event.values, values, n * sizeof(double));
+    push_event(&event);
+}
+
+static void set_all_cb(AdaComError err, double *values, int n);
+
+static void submit_desired(void)
+{
+    if (!desired_pending || adacom_is_busy())
+        return;
+    desired_pending = false;
+    int n = adacom_num_channels();
+    AdaComError err = adacom_set_all(desired, n, set_all_cb);
+    if (err != ADACOM_OK) {
+        push_set_all(err, desired, n);
+    }
+}
+
+static void set_all_cb(AdaComError err, double *values, int n)
+{
+    push_set_all(err, values, n);
+    // Requests which came in meanwhile
+    submit_desired();
+}
+
+static void connect_cb(AdaComError err)
+{
+    LibAdaComEvent event = {
+        .type = LIBADACOM_EVT_CONNECT,
+        .err = err,
+        .state = adacom_state(),
+        .ch = -1
+    };
+    if (err == ADACOM_OK) {
+        strncpy(event.model, adacom_model(), LIBADACOM_ID_SIZE - 1);
+        strncpy(event.sn, adacom_sn(), LIBADACOM_ID_SIZE - 1);
+        event.num_channels = adacom_num_channels();
+        adacom_get_all(event.values, event.num_channels);
+    }
+    push_event(&event);
+}
+
+static void applied_cb(int ch, double value, uint64_t req_ns,
+        uint64_t applied_ns)
+{
+    LibAdaComEvent event = {
+        .type = LIBADACOM_EVT_APPLIED,
+        .err = ADACOM_OK,
+        .state = adacom_state(),
+        .ch = ch,
+        .value = value,
+        .req_ns = req_ns,
+        .applied_ns = applied_ns
+    };
+    push_event(&event);
+}
+
+static void state_cb(AdaComState state)
+{
+    LibAdaComEvent event = {
+        .type = LIBADACOM_EVT_STATE,
+        .err = ADACOM_OK,
+        .state = state,
+        .ch = -1
+    };
+    push_event(&event);
+}
+
+static void connect_device(void)
+{
+    AdaComState state = adacom_state();
+    if (state == ADACOM_STATE_CONNECTED || state == ADACOM_STATE_CONNECTING)
+        return;
+    // Close a link which is left from a failed attempt
+    adacom_disconnect();
+    AdaComError err = adacom_connect(connect_cb);
+    if (err != ADACOM_OK) {
+        connect_cb(err);
+    }
+}
+
+static void process_cmd(const LibAdaComCmd *cmd)
+{
+    if (cmd->type == LIBADACOM_CMD_CONNECT) {
+        connect_device();
+        return;
+    }
+    int n = adacom_num_channels();
+    if (adacom_state() != ADACOM_STATE_CONNECTED) {
+        push_set_all(ADACOM_ERR_NOT_CONNECTED, cmd->values, 0);
+        return;
+    }
+    if (cmd->type == LIBADACOM_CMD_SET_ALL) {
+        if (cmd->n != n) {
+            push_set_all(ADACOM_ERR_NUM_CHANNELS, cmd->values, 0);
+            return;
+        }
+        memcpy(desired, cmd->values, n * sizeof(double));
+    } else if (cmd->type == LIBADACOM_CMD_SET_CHANNEL) {
+        if (cmd->ch >= n) {
+            push_set_all(ADACOM_ERR_INVALID_CHANNEL, cmd->values, 0);
+            return;
+        }
+        // Start from the values which are set or about to be set
+        if (!desired_pending) {
+            adacom_get_target(desired, n);
+        }
+        desired[cmd->ch] = cmd->values[0];
+    }
+    desired_pending = true;
+}
+
+static void wake_cb(MlIo *self, int fd, ml_io_flag_t flags, void *arg)
+{
+    if (!(flags & ML_IO_READ))
+        return;
+    eventfd_t count;
+    eventfd_read(fd, &count);
+    if (!atomic_load(&running)) {
+        mloop_stop();
+        return;
+    }
+    size_t t;
+    while (ring_can_pop(&cmds.head, &cmds.tail, &t)) {
+        process_cmd(&cmds.slots[t & (LIBADACOM_SLOTS - 1)]);
+        atomic_store_explicit(&cmds.tail, t + 1, memory_order_release);
+    }
+    // All requests of this wake up in one device update
+    submit_desired();
+}
+
+static void *thread_main(void *arg)
+{
+    mloop_init();
+    adacom_init(device);
+    adacom_set_applied_cb(applied_cb);
+    adacom_set_state_cb(state_cb);
+    wake_io = init(Io, wake_fd);
+    mloop_io_new(&wake_io, ML_IO_READ, wake_cb, NULL);
+    connect_device();
+    mloop_run();
+    // Closes the wake up fd as well
+    destroy(&wake_io);
+    adacom_destroy();
+    return NULL;
+}
+
+/*
+ * Application side
+ */
+static AdaComError push_cmd(LibAdaComCmdType type, int ch, const double *values,
+        int n)
+{
+    if (!atomic_load(&running))
+        return ADACOM_ERR_NOT_CONNECTED;
+    size_t h;
+    if (!ring_can_push(&cmds.head, &cmds.tail, &h))
+        return ADACOM_ERR_DEVICE_BUSY;
+    LibAdaComCmd *cmd = &cmds.slots[h & (LIBADACOM_SLOTS - 1)];
+    cmd->type = type;
+    cmd->ch = ch;
+    cmd->n = n;
+    if (n > 0) {
+        memcpy(cmd->values, values, n * sizeof(double));
+    }
+    atomic_store_explicit(&cmds.head, h + 1, memory_order_release);
+    signal_fd(wake_fd);
+    return ADACOM_OK;
+}
+
+int libadacom_open(const char *dev)
+{
+    if (atomic_load(&running))
+        return -1;
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0 || notify_fd < 0)
+        goto err;
+    device = strdup(dev);
+    atomic_store(&cmds.head, 0);
+    atomic_store(&cmds.tail, 0);
+    atomic_store(&events.head, 0);
+    atomic_store(&events.tail, 0);
+    atomic_store(&dropped, 0);
+    desired_pending = false;
+    atomic_store(&running, true);
+    if (pthread_create(&thread, NULL, thread_main, NULL) != 0) {
+        atomic_store(&running, false);
+        free(device);
+        device = NULL;
+        goto err;
+    }
+    return notify_fd;
+err:
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
+    if (notify_fd >= 0) {
+        close(notify_fd);
+    }
+    wake_fd = notify_fd = -1;
+    return -1;
+}
+
+int libadacom_fd(void)
+{
+    return notify_fd;
+}
+
+void libadacom_close(void)
+{
+    if (!atomic_load(&running))
+        return;
+    atomic_store(&running, false);
+    signal_fd(wake_fd);
+    pthread_join(thread, NULL);
+    close(notify_fd);
+    wake_fd = notify_fd = -1;
+    free(device);
+    device = NULL;
+}
+
+AdaComError libadacom_connect(void)
+{
+    return push_cmd(LIBADACOM_CMD_CONNECT, -1, NULL, 0);
+}
+
+AdaComError libadacom_set_all(const double *values, int n)
+{
+    if (n <= 0 || n > ADACOM_MAX_CHANNELS)
+        return ADACOM_ERR_NUM_CHANNELS;
+    return push_cmd(LIBADACOM_CMD_SET_ALL, -1, values, n);
+}
+
+AdaComError libadacom_set_channel(int ch, double value)
+{
+    if (ch < 0 || ch >= ADACOM_MAX_CHANNELS)
+        return ADACOM_ERR_INVALID_CHANNEL;
+    return push_cmd(LIBADACOM_CMD_SET_CHANNEL, ch, &value, 1);
+}
+
+int libadacom_process(void)
+{
+    if (notify_fd < 0)
+        return 0;
+    eventfd_t count;
+    eventfd_read(notify_fd, &count);
+    size_t t = atomic_load_explicit(&events.tail, memory_order_relaxed);
+    size_t h = atomic_load_explicit(&events.head, memory_order_acquire);
+    return h - t;
+}
+
+bool libadacom_next_event(LibAdaComEvent *event)
+{
+    size_t t;
+    if (!ring_can_pop(&events.head, &events.tail, &t))
+        return false;
+    *event = events.slots[t & (LIBADACOM_SLOTS - 1)];
+    atomic_store_explicit(&events.tail, t + 1, memory_order_release);
+    return true;
+}
+
+unsigned long libadacom_dropped(void)
+{
+    return atomic_load(&dropped);
+}
@@ -0,0 +1,71 @@
+#ifndef _LIBADACOM_H_
+#define _LIBADACOM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "adacom.h"
+
+/*
+ * Embeddable interface of adacom for applications with their own event
+ * loop (epoll, poll, libevent, ...).
+ *
+ * The device is driven on a thread of the library, which runs its own
+ * masc main loop, i.e. the application must not run a masc main loop
+ * itself. Requests are queued without blocking, results are queued as
+ * events. The fd of libadacom_open() becomes readable when events are
+ * pending, then call libadacom_process() and fetch the events with
+ * libadacom_next_event(). Only use the API from a single thread.
+ */
+
+#define LIBADACOM_SLOTS 64
+#define LIBADACOM_ID_SIZE 32
+
+
+typedef enum {
+    // Result of a connect (model, sn and num_channels on success)
+    LIBADACOM_EVT_CONNECT,
+    // A set request has been completed (values: confirmed attenuations)
+    LIBADACOM_EVT_SET_ALL,
+    // The device has confirmed the attenuation of a channel
+    LIBADACOM_EVT_APPLIED,
+    // The connection state has changed, e.g. reconnect with
+    // libadacom_connect() after ADACOM_STATE_ERROR or _DISCONNECTED
+    LIBADACOM_EVT_STATE
+} LibAdaComEventType;
+
+typedef struct {
+    LibAdaComEventType type;
+    AdaComError err;
+    // Connection state at the time of the event
+    AdaComState state;
+    int ch;
+    double value;
+    // CLOCK_REALTIME ns of the request and its confirmation
+    uint64_t req_ns;
+    uint64_t applied_ns;
+    char model[LIBADACOM_ID_SIZE];
+    char sn[LIBADACOM_ID_SIZE];
+    int num_channels;
+    double values[ADACOM_MAX_CHANNELS];
+} LibAdaComEvent;
+
+
+// Starts the device thread and connects, returns the fd to poll (or -1)
+int libadacom_open(const char *device);
+int libadacom_fd(void);
+void libadacom_close(void);
+
+// The requests are sent as soon as the device is ready, a later request
+// replaces the values of one which is still waiting.
+AdaComError libadacom_connect(void);
+AdaComError libadacom_set_all(const double *values, int n);
+AdaComError libadacom_set_channel(int ch, double value);
+
+// Resets the readiness of the fd and returns the number of pending events
+int libadacom_process(void);
+bool libadacom_next_event(LibAdaComEvent *event);
+// Events which have been dropped because the application did not fetch them
+unsigned long libadacom_dropped(void);
+
+#endif /* _LIBADACOM_H_ */
@@ -3,17 +3,38 @@
  *
  */
 
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
 #include <masc.h>
 
 #include "cfg.h"
 #include "adacom.h"
 #include "tui.h"
+#include "trace.h"
+#include "ctrl.h"
+#include "shm.h"
+#include "events.h"
+#include "metrics.h"
+#include "cli.h"
+#include "series.h"
+#include "mobility.h"
+#include "fading.h"
+#include "sim.h"
+#include "profile.h"
+#include "characterise.h"
+#include "dlog.h"
+#include "journal.h"
 
 
 typedef enum {
     ADACON_STATE_STOPPED,
     ADACON_STATE_PLAY_SINGLE,
-    ADACON_STATE_PLAY_COUNTINOUS
+    ADACON_STATE_PLAY_COUNTINOUS,
+    ADACON_STATE_ARMED,
+    ADACON_STATE_PLAY_SERIES,
+    ADACON_STATE_PLAY_MOBILITY
 } AdaConState;
 
 typedef enum {
@@ -21,9 +42,30 @@ typedef enum {
     HANDOFF_STATE_RECOVER
 } HandoffState;
 
+// Time in ms an armed handoff wakes up before its first command is due
+#define HANDOFF_ARM_LEAD 20
+// Command timeout derived from a timing profile (multiple of the slowest
+// measured answer, but at least the minimum in ms)
+#define PROFILE_TIMEOUT_FACTOR 4
+#define PROFILE_TIMEOUT_MIN 50
+// Interval in ms the player state is written to the journal
+#define JOURNAL_PLAYER_INTERVAL 100
+
+
+static const char *state_to_cstr[] = {
+    [ADACON_STATE_STOPPED] = "STOPPED",
+    [ADACON_STATE_PLAY_SINGLE] = "PLAY_SINGLE",
+    [ADACON_STATE_PLAY_COUNTINOUS] = "PLAY_COUNTINOUS",
+    [ADACON_STATE_ARMED] = "ARMED",
+    [ADACON_STATE_PLAY_SERIES] = "PLAY_SERIES",
+    [ADACON_STATE_PLAY_MOBILITY] = "PLAY_MOBILITY"
+};
+
 
 static AdaConState state = ADACON_STATE_STOPPED;
 static int n_channels = 0;
+// Send order of a set all, the members of a group are consecutive
+static int send_order[ADACOM_MAX_CHANNELS];
 static int current_channel = -1;
 static int ctrl_chs[ADACOM_MAX_CHANNELS];
 static int n_ctrl_chs = 0;
@@ -33,7 +75,143 @@ static HandoffState ho_state;
 static int ho_ctrl_ch_idx = -1;
 static int ho_interval;
 static int ho_start;
+static int ho_tick;
+// Handoff which is armed for an absolute start instant
+static MlTimer *arm_timer = NULL;
+static clockid_t arm_clock;
+static uint64_t arm_first_tick_ns;
+// Requested values which are sent as soon as the device is ready
+static double desired[ADACOM_MAX_CHANNELS];
+static bool desired_pending = false;
+// The kill switch values are on their way, nothing may be applied meanwhile
+static bool kill_pending = false;
+static MlTimer *desired_timer = NULL;
+
+// Playback of recorded path loss series
+static bool series_loaded = false;
+static MlTimer *series_timer = NULL;
+static int series_start;
+static int series_chs[SERIES_MAX_COLUMNS];
+// Mobility and path loss model
+static bool mobility_loaded = false;
+static MlTimer *mobility_timer = NULL;
+static int mobility_start;
+// Last values of a streamed source (series or mobility)
+static double stream_last[ADACOM_MAX_CHANNELS];
+static int stream_interval;
+// Slow fading overlay
+static bool fading_loaded = false;
+static bool fading_active = false;
+static MlTimer *fading_timer = NULL;
+static int fading_start;
+static int fading_interval;
+static int fading_src[ADACOM_MAX_CHANNELS];
+static double base_values[ADACOM_MAX_CHANNELS];
+// Shared memory interface for external producers
+static bool shm_enabled = false;
+static MlTimer *shm_timer = NULL;
+static uint64_t shm_generation = 0;
+static uint64_t shm_submitted_gen = 0;
+static double shm_last[ADACOM_MAX_CHANNELS];
+// Virtual time simulation against a simulated device
+static bool simulating = false;
+static bool ho_continuous = false;
+static int ho_count = 0;
+static MlTimer *recovery_timer = NULL;
+// Background verification of the device attenuations
+static MlTimer *verify_timer = NULL;
+// Estimated time in ms until a set command takes effect (0: unknown)
+static double lead_estimate = 0;
+static bool events_enabled = false;
+// Planned versus applied attenuation of the solo channel of a handoff
+static bool ho_err_active = false;
+static int ho_err_ch;
+static int ho_err_count;
+static double ho_err_sum;
+static double ho_err_max;
+// Journal of the state to resume after a restart
+static bool journal_enabled = false;
+static MlTimer *journal_timer = NULL;
+static JournalState restored;
+static bool restore_pending = false;
+
+// Forward declarations
+static void apply_desired(void);
+static void publish_applied(void);
+static void resume_from_journal(void);
+static void report_handoff_error(void);
+
+/*
+ * Clock, timers and device access of the players, which are either the real
+ * ones or the ones of the simulation.
+ */
+static int run_time(void)
+{
+    return simulating ? sim_run_time() : mloop_run_time();
+}
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Run time of an instant reported by the device (or the simulation)
+static int applied_run_time(uint64_t applied_ns)
+{
+    if (simulating)
+        return applied_ns / 1000000;
+    int64_t age = (int64_t)(clock_ns(CLOCK_REALTIME) - applied_ns) / 1000000;
+    return run_time() - age;
+}
+
+static void timer_in(MlTimer *timer, int ms)
+{
+    if (simulating) {
+        sim_timer_in(timer, ms);
+    } else {
+        ml_timer_in(timer, ms);
+    }
+}
+
+static void timer_add(MlTimer *timer, int ms)
+{
+    if (simulating) {
+        sim_timer_add(timer, ms);
+    } else {
+        ml_timer_add(timer, ms);
+    }
+}
+
+static int select_channel(int ch)
+{
+    return simulating ? ch : tui_select_channel(ch);
+}
+
+static bool device_connected(void)
+{
+    return simulating || adacom_state() == ADACOM_STATE_CONNECTED;
+}
 
+static bool device_is_busy(void)
+{
+    return simulating ? sim_is_busy() : adacom_is_busy();
+}
+
+static AdaComError device_get_all(double *values)
+{
+    if (simulating)
+        return sim_get_all(values, n_channels);
+    return adacom_get_all(values, n_channels);
+}
+
+static AdaComError device_get_target(double *values)
+{
+    if (simulating)
+        return sim_get_target(values, n_channels);
+    return adacom_get_target(values, n_channels);
+}
 
 static void action_select_ch(int key) {
     if (state != ADACON_STATE_STOPPED)
@@ -69,19 +247,73 @@ static void atten_set_cb(AdaComError err, int ch, double value)
     if (err != ADACOM_OK) {
         log_error("Unable to set attenuation of channel %i!", ch);
         tui_adacom_state(adacom_state());
+        desired_pending = false;
         return;
     }
     tui_set_attenuation(ch, value);
+    publish_applied();
+    apply_desired();
+}
+
+static void output_settled(void)
+{
+    // A finished handoff is complete once its last command is through
+    if (state == ADACON_STATE_STOPPED && !desired_pending
+            && !device_is_busy()) {
+        report_handoff_error();
+    }
+}
+
+static void sim_set_all_cb(AdaComError err, double *values, int n)
+{
+    apply_desired();
+    output_settled();
 }
 
 static void atten_set_all_cb(AdaComError err, double *values, int n)
 {
+    // An urgent request took over, it reports with its own callback
+    if (err == ADACOM_ERR_PREEMPTED)
+        return;
     if (err != ADACOM_OK) {
         log_error("Unable to set all attenuations!");
         tui_adacom_state(adacom_state());
+        desired_pending = false;
+        output_settled();
         return;
     }
     tui_set_attenuations(values, n);
+    publish_applied();
+    apply_desired();
+    output_settled();
+}
+
+static void journal_target(AdaComError err)
+{
+    if (!journal_enabled || err != ADACOM_OK)
+        return;
+    double values[n_channels];
+    adacom_get_target(values, n_channels);
+    journal_requested(values, n_channels);
+}
+
+static AdaComError device_set_all(double *values)
+{
+    if (simulating)
+        return sim_set_all(values, n_channels, sim_set_all_cb);
+    AdaComError err = adacom_set_all(values, n_channels, atten_set_all_cb);
+    journal_target(err);
+    return err;
+}
+
+static AdaComError device_set_all_unacked(double *values)
+{
+    // The simulated device always acknowledges
+    if (simulating)
+        return sim_set_all(values, n_channels, sim_set_all_cb);
+    AdaComError err = adacom_set_all_unacked(values, n_channels);
+    journal_target(err);
+    return err;
 }
 
 
@@ -124,21 +356,89 @@ static void set_all_in_same_group(int ch, double *values, double atten)
     group_set_channels(group, values, atten);
 }
 
+static double limit_attenuation(double atten)
+{
+    if (atten > cfg.max_attenuation) {
+        return cfg.max_attenuation;
+    } else if (atten < cfg.min_attenuation) {
+        return cfg.min_attenuation;
+    }
+    return atten;
+}
+
+static double quantize_attenuation(double atten)
+{
+    atten = limit_attenuation(atten);
+    return (int)(atten / ADACOM_MIN_INTERVAL + 0.5) * ADACOM_MIN_INTERVAL;
+}
+
+static long fading_tick(void)
+{
+    return (run_time() - fading_start) / fading_interval;
+}
+
+/*
+ * Output stage: the controls work with their own (base) values, the fading
+ * overlay is only added to the values which are sent to the device.
+ */
+static AdaComError output_get(double *values)
+{
+    if (!fading_active)
+        return device_get_all(values);
+    memcpy(values, base_values, n_channels * sizeof(double));
+    return ADACOM_OK;
+}
+
+static AdaComError output_get_target(double *values)
+{
+    if (!fading_active)
+        return device_get_target(values);
+    memcpy(values, base_values, n_channels * sizeof(double));
+    return ADACOM_OK;
+}
+
+static void output_apply_fading(const double *values, double *out)
+{
+    long tick = fading_tick();
+    for (int ch = 0; ch < n_channels; ch++) {
+        out[ch] = quantize_attenuation(limit_attenuation(values[ch]
+                + fading_offset(fading_src[ch], tick)));
+    }
+}
+
+static AdaComError output_send(double *values, bool unacked)
+{
+    double out[n_channels];
+    if (fading_active) {
+        memcpy(base_values, values, n_channels * sizeof(double));
+        output_apply_fading(values, out);
+        values = out;
+    }
+    if (unacked)
+        return device_set_all_unacked(values);
+    return device_set_all(values);
+}
+
+static AdaComError output_set(double *values)
+{
+    return output_send(values, false);
+}
+
 static void set_group(int ch, double atten)
 {
     List *group = get_group_by_channel(ch);
-    if (group == NULL) {
+    if (group == NULL && !fading_active) {
         // Channel is in no group, set in and leave.
-        adacom_set_channel(current_channel, atten, atten_set_cb);
+        journal_target(adacom_set_channel(ch, atten, atten_set_cb));
         return;
     }
     // Get all channel attenuation values
     double values[n_channels];
-    adacom_get_all(values, n_channels);
+    output_get(values);
     // Change value of the channels in the same group
-    group_set_channels(group, values, atten);
+    set_all_in_same_group(ch, values, atten);
     // Set all channels
-    adacom_set_all(values, n_channels, atten_set_all_cb);
+    output_set(values);
 }
 
 static void action_min_max_atten(int key)
@@ -160,13 +460,42 @@ static double inc_dec_attenuation(double value, bool increase)
     return (increase ? steps + 1 : steps - 1) * atten_interval;
 }
 
+static void apply_desired(void)
+{
+    if (!desired_pending || kill_pending || device_is_busy())
+        return;
+    desired_pending = false;
+    shm_submitted_gen = shm_generation;
+    output_set(desired);
+}
+
+static void desired_timer_cb(MlTimer *timer, void *arg)
+{
+    apply_desired();
+}
+
+static double *get_desired(void)
+{
+    // Start from the values which are set or about to be set on the device
+    if (!desired_pending) {
+        output_get_target(desired);
+        desired_pending = true;
+        // Apply all requests of this loop iteration in one device update
+        timer_in(desired_timer, 0);
+    }
+    return desired;
+}
+
 static void action_up_down_atten(int key) {
     if (current_channel < 0 || state != ADACON_STATE_STOPPED ||
             adacom_state() != ADACOM_STATE_CONNECTED)
         return;
-    double atten = adacom_get_channel(current_channel);
-    atten = inc_dec_attenuation(atten, key == TUI_KEY_UP);
-    set_group(current_channel, atten);
+    // Continue from the last requested value, so that auto-repeated key steps
+    // accumulate instead of getting lost while the device is busy.
+    double *values = get_desired();
+    double atten = inc_dec_attenuation(values[current_channel],
+            key == TUI_KEY_UP);
+    set_all_in_same_group(current_channel, values, limit_attenuation(atten));
 }
 
 static void action_ch_solo(int key) {
@@ -174,7 +503,7 @@ static void action_ch_solo(int key) {
             adacom_state() != ADACOM_STATE_CONNECTED)
         return;
     double values[n_channels];
-    adacom_get_all(values, n_channels);
+    output_get(values);
     // Set all channels in channels except the solo chanel to max attenuation
     for (int i = 0; i < n_ctrl_chs; i++) {
         int ch = ctrl_chs[i];
@@ -182,7 +511,7 @@ static void action_ch_solo(int key) {
     }
     // Set all channels in the same group as current channel to min attenuation
     set_all_in_same_group(current_channel, values, cfg.min_attenuation);
-    adacom_set_all(values, n_channels, atten_set_all_cb);
+    output_set(values);
 }
 
 static void set_solo_and_others(int solo_ch, double solo_val, double *values)
@@ -213,12 +542,12 @@ static void action_ch_solo_step(int key) {
         return;
     double values[n_channels];
     // Get all channel attenuation values
-    adacom_get_all(values, n_channels);
+    output_get(values);
     // Calculate new attenuation for solo channel
     double solo_val = values[current_channel];
     solo_val = inc_dec_attenuation(solo_val, false);
     set_solo_and_others(current_channel, solo_val, values);
-    adacom_set_all(values, n_channels, atten_set_all_cb);
+    output_set(values);
 }
 
 static int get_ctrl_ch_idx(int channel)
@@ -238,31 +567,159 @@ static int next_ho_channel(void)
     return ctrl_chs[ho_ctrl_ch_idx];
 }
 
-static void player_cb(MlTimer *timer, void *arg)
+static double handoff_atten(int ho_time)
+{
+    // Attenuation of the solo channel fades linearly during the action time
+    double ho_progress = (double)ho_time / cfg.action_time;
+    return cfg.max_attenuation
+            - (cfg.max_attenuation - cfg.min_attenuation) * ho_progress;
+}
+
+static double dispatch_lead(void)
+{
+    if (cfg.dispatch_lead >= 0)
+        return cfg.dispatch_lead;
+    // Prefer the measured round trip times of the set commands (the ones of
+    // the set all sequences included), info and status take longer
+    if (!simulating) {
+        const Hist *h = adacom_cmd_hist(ADACOM_CMD_SET);
+        if (h->count > 0)
+            return hist_percentile(h, 50) / 1000.0;
+    }
+    return lead_estimate;
+}
+
+static double predict_atten(int solo_ch, int ho_time, const double *values)
+{
+    double lead = dispatch_lead();
+    if (lead <= 0)
+        return limit_attenuation(handoff_atten(ho_time));
+    // The channels of a set all sequence are sent one after another, so the
+    // command of the solo channel also waits for the changed channels in
+    // front of it.
+    double next[n_channels];
+    memcpy(next, values, n_channels * sizeof(double));
+    set_solo_and_others(solo_ch,
+            limit_attenuation(handoff_atten(ho_time + lead)), next);
+    int pos = 1;
+    for (int i = 0; i < n_channels && send_order[i] != solo_ch; i++) {
+        int ch = send_order[i];
+        if (quantize_attenuation(next[ch]) != quantize_attenuation(values[ch]))
+            pos++;
+    }
+    return limit_attenuation(handoff_atten(ho_time + lead * pos));
+}
+
+static void report_handoff_error(void)
+{
+    if (!ho_err_active)
+        return;
+    ho_err_active = false;
+    if (ho_err_count == 0)
+        return;
+    // Express the attenuation error as a time error along the fade as well
+    double slope = (cfg.max_attenuation - cfg.min_attenuation)
+            / (cfg.action_time > 0 ? cfg.action_time : 1);
+    double mean = ho_err_sum / ho_err_count;
+    log_info("Handoff to channel %i: planned vs applied error mean %.2f dB "
+            "(%.1f ms), max %.2f dB over %i commands.", ho_err_ch + 1, mean,
+            mean / slope, ho_err_max, ho_err_count);
+}
+
+static void record_handoff_error(int ch, double value, uint64_t applied_ns)
+{
+    if (!ho_err_active || ch != ho_err_ch || fading_active)
+        return;
+    // Planned for the instant the device confirmed the value
+    int ho_time = applied_run_time(applied_ns) - ho_start;
+    double planned = limit_attenuation(handoff_atten(ho_time));
+    double err = value - planned;
+    ho_err_sum += err;
+    ho_err_count++;
+    if (fabs(err) > fabs(ho_err_max)) {
+        ho_err_max = err;
+    }
+}
+
+static void applied_cb(int ch, double value, uint64_t req_ns,
+        uint64_t applied_ns)
+{
+    if (events_enabled) {
+        events_emit(ch, value, req_ns, applied_ns);
+    }
+    record_handoff_error(ch, value, applied_ns);
+    journal_applied(ch, value);
+}
+
+static void output_step(double *values, bool final)
+{
+    if (!cfg.unacked.enabled) {
+        output_set(values);
+        return;
+    }
+    // Intermediate steps are streamed (and dropped if the link is full),
+    // the checkpoints and the final step are acknowledged.
+    bool checkpoint = cfg.unacked.checkpoint > 0
+            && ho_tick % cfg.unacked.checkpoint == 0;
+    if (!final && !checkpoint) {
+        output_send(values, true);
+        return;
+    }
+    // Applied after the command in flight, it also repeats lost steps
+    memcpy(get_desired(), values, n_channels * sizeof(double));
+}
+
+static bool player_tick(void)
 {
     double values[n_channels];
-    int ho_time = mloop_run_time() - ho_start;
-    adacom_get_all(values, n_channels);
+    int ho_time = run_time() - ho_start;
+    // Report how late this tick is compared to its scheduled time
+    int lateness = ho_time - ho_tick++ * ho_interval;
+    tui_tick_lateness(lateness);
+    if (lateness >= ho_interval) {
+        metrics_count_overrun();
+    }
+    output_get(values);
     // Calculate new attenuation for solo channel
     int solo_ch = ctrl_chs[ho_ctrl_ch_idx];
-    double ho_progress = (double)ho_time / cfg.action_time;
-    double solo_val = cfg.max_attenuation \
-            - (cfg.max_attenuation - cfg.min_attenuation) * ho_progress;
-    log_debug("player: time: %i ms, ch: %i, atten: %.2f",
+    double solo_val = predict_atten(solo_ch, ho_time, values);
+    dlog_debug("player: time: %i ms, ch: %i, atten: %.2f",
             ho_time, solo_ch, solo_val);
-    if (solo_val < values[solo_ch]) {
+    bool final = ho_time >= cfg.action_time;
+    // The confirmed values may lag behind unacknowledged steps
+    if (solo_val < values[solo_ch] || (final && cfg.unacked.enabled)) {
         set_solo_and_others(solo_ch, solo_val, values);
-        adacom_set_all(values, n_channels, atten_set_all_cb);
+        output_step(values, final);
     }
     // Decide the next step in the handoff sequence.
-    if (ho_time < cfg.action_time) {
-        ml_timer_add(play_timer, ho_interval);
-    } else {
-        current_channel = tui_select_channel(next_ho_channel());
-        state = ADACON_STATE_STOPPED;
+    if (!final) {
+        return true;
+    }
+    current_channel = select_channel(next_ho_channel());
+    state = ADACON_STATE_STOPPED;
+    metrics_count_handoff();
+    return false;
+}
+
+static void player_cb(MlTimer *timer, void *arg)
+{
+    if (player_tick()) {
+        timer_add(play_timer, ho_interval);
+    } else if (ho_continuous) {
+        timer_in(recovery_timer, cfg.recovery_time);
     }
 }
 
+static void start_handoff_error(int ch)
+{
+    report_handoff_error();
+    ho_err_active = true;
+    ho_err_ch = ch;
+    ho_err_count = 0;
+    ho_err_sum = 0;
+    ho_err_max = 0;
+}
+
 static bool trigger_handoff_to(int ch)
 {
     int idx = get_ctrl_ch_idx(ch);
@@ -272,8 +729,83 @@ static bool trigger_handoff_to(int ch)
     ho_ctrl_ch_idx = idx;
     ho_state = HANDOFF_STATE_ACTIVE;
     ho_interval = 1000 / cfg.sample_rate;
-    ho_start = mloop_run_time();
-    ml_timer_in(play_timer, ho_interval);
+    ho_start = run_time();
+    start_handoff_error(ch);
+    ho_tick = 1;
+    timer_in(play_timer, ho_interval);
+    return true;
+}
+
+static void arm_timer_cb(MlTimer *timer, void *arg)
+{
+    if (adacom_state() != ADACOM_STATE_CONNECTED) {
+        log_error("Armed handoff has been aborted, not connected!");
+        state = ADACON_STATE_STOPPED;
+        return;
+    }
+    // The first tick is pre-staged: wait for the exact instant on the
+    // requested clock and put its command on the wire right away.
+    struct timespec ts = {
+        .tv_sec = arm_first_tick_ns / 1000000000ULL,
+        .tv_nsec = arm_first_tick_ns % 1000000000ULL
+    };
+    uint64_t sleep_start = clock_ns(CLOCK_MONOTONIC);
+    while (clock_nanosleep(arm_clock, TIMER_ABSTIME, &ts, NULL) == EINTR);
+    // The loop time is cached from before the sleep
+    int slept = (clock_ns(CLOCK_MONOTONIC) - sleep_start) / 1000000;
+    ho_start = mloop_run_time() + slept - ho_interval;
+    start_handoff_error(ctrl_chs[ho_ctrl_ch_idx]);
+    state = ADACON_STATE_PLAY_SINGLE;
+    bool was_busy = adacom_is_busy();
+    bool cont = player_tick();
+    int64_t offset = clock_ns(arm_clock) - arm_first_tick_ns;
+    if (!was_busy && adacom_is_busy()) {
+        log_info("Armed handoff to channel %i started %.3f ms after the "
+                "requested instant.", ctrl_chs[ho_ctrl_ch_idx] + 1,
+                offset / 1000000.0);
+    } else {
+        log_warn("Armed handoff to channel %i started, but its first "
+                "command could not be sent at the requested instant!",
+                ctrl_chs[ho_ctrl_ch_idx] + 1);
+    }
+    if (cont) {
+        ml_timer_in(play_timer, ho_interval + slept);
+    }
+}
+
+static bool arm_handoff(int ch, clockid_t clock, uint64_t start_ns)
+{
+    int idx = get_ctrl_ch_idx(ch);
+    if (idx < 0) {
+        log_error("Not able to arm handoff sequence for channel %i!", ch + 1);
+        return false;
+    }
+    ho_ctrl_ch_idx = idx;
+    ho_state = HANDOFF_STATE_ACTIVE;
+    ho_interval = 1000 / cfg.sample_rate;
+    ho_tick = 1;
+    // The fade starts at the requested instant, its first tick follows one
+    // interval later (same as for an immediately started handoff).
+    arm_clock = clock;
+    arm_first_tick_ns = start_ns + ho_interval * 1000000ULL;
+    int64_t delay_ms = ((int64_t)(arm_first_tick_ns - clock_ns(clock)))
+            / 1000000 - HANDOFF_ARM_LEAD;
+    current_channel = tui_select_channel(ch);
+    state = ADACON_STATE_ARMED;
+    ml_timer_in(arm_timer, delay_ms > 0 ? delay_ms : 0);
+    log_info("Handoff to channel %i armed.", ch + 1);
+    return true;
+}
+
+static bool start_single_handoff(int ch)
+{
+    if (!trigger_handoff_to(ch)) {
+        log_error("Not able to start handoff sequence for channel %i!",
+                ch + 1);
+        return false;
+    }
+    current_channel = select_channel(ch);
+    state = ADACON_STATE_PLAY_SINGLE;
     return true;
 }
 
@@ -285,15 +817,15 @@ static void action_single_handoff(int key)
         if (current_channel < 0) {
             current_channel = tui_select_channel(next_ho_channel());
         }
-        if (trigger_handoff_to(current_channel)) {
-            state = ADACON_STATE_PLAY_SINGLE;
-        } else {
-            log_error("Not able to start handoff sequence for channel %i!",
-                    current_channel + 1);
-        }
+        start_single_handoff(current_channel);
     } else if (state == ADACON_STATE_PLAY_COUNTINOUS) {
         ml_timer_cancle(play_timer);
         state = ADACON_STATE_STOPPED;
+        report_handoff_error();
+    } else if (state == ADACON_STATE_ARMED) {
+        log_info("Armed handoff has been cancelled.");
+        ml_timer_cancle(arm_timer);
+        state = ADACON_STATE_STOPPED;
     }
 }
 
@@ -305,15 +837,64 @@ static void set_all_channels_to(double value) {
     for (int ch = 0; ch < n_channels; ch++) {
         values[ch] = value;
     }
-    adacom_set_all(values, n_channels, atten_set_all_cb);
+    output_set(values);
 }
 
 static void action_all_min(int key) {
     set_all_channels_to(cfg.min_attenuation);
 }
 
+static void cancel_pending_work(void)
+{
+    // Nothing may override the values of the kill switch afterwards
+    ml_timer_cancle(play_timer);
+    ml_timer_cancle(arm_timer);
+    ml_timer_cancle(recovery_timer);
+    ml_timer_cancle(series_timer);
+    ml_timer_cancle(mobility_timer);
+    ml_timer_cancle(desired_timer);
+    desired_pending = false;
+    if (fading_active) {
+        ml_timer_cancle(fading_timer);
+        fading_active = false;
+    }
+    if (state != ADACON_STATE_STOPPED) {
+        log_warn("%s has been stopped by the kill switch!",
+                state_to_cstr[state]);
+        state = ADACON_STATE_STOPPED;
+    }
+    report_handoff_error();
+}
+
+static void kill_switch_cb(AdaComError err, double *values, int n)
+{
+    // Drop what has been requested while the kill switch was pending, e.g.
+    // the re-push of a verification which was in flight.
+    kill_pending = false;
+    desired_pending = false;
+    atten_set_all_cb(err, values, n);
+}
+
 static void action_all_max(int key) {
-    set_all_channels_to(cfg.max_attenuation);
+    // Kill switch: also during a playback and ahead of the running command,
+    // so that all channels are at max after at most one command plus the
+    // set commands of the channels.
+    if (adacom_state() != ADACOM_STATE_CONNECTED)
+        return;
+    cancel_pending_work();
+    double values[n_channels];
+    for (int ch = 0; ch < n_channels; ch++) {
+        values[ch] = cfg.max_attenuation;
+    }
+    kill_pending = true;
+    AdaComError err = adacom_set_all_prio(values, n_channels,
+            ADACOM_PRIO_URGENT, kill_switch_cb);
+    journal_target(err);
+    if (err != ADACOM_OK || !adacom_is_busy()) {
+        // Failed or already at max, there is no completion to wait for
+        kill_pending = false;
+        desired_pending = false;
+    }
 }
 
 static void init_control_channels(void) {
@@ -336,13 +917,149 @@ static void sync_grouped_channels(double *values)
     destroy(&itr);
 }
 
+static void init_send_order(void)
+{
+    int groups[n_channels];
+    for (int ch = 0; ch < n_channels; ch++) {
+        groups[ch] = -1;
+    }
+    int g = 0;
+    Iter itr = init(Iter, cfg.groups);
+    for (List *grp = next(&itr); grp != NULL; grp = next(&itr), g++) {
+        Iter jtr = init(Iter, grp);
+        for (Int *c = next(&jtr); c != NULL; c = next(&jtr)) {
+            if (c->val < n_channels) {
+                groups[c->val] = g;
+            }
+        }
+        destroy(&jtr);
+    }
+    destroy(&itr);
+    adacom_group_order(groups, n_channels, send_order);
+    if (simulating) {
+        sim_set_order(send_order, n_channels);
+    } else {
+        adacom_set_groups(groups, n_channels);
+    }
+}
+
+static void init_fading_sources(void)
+{
+    // Channels of the same group share the fading of the first member
+    for (int ch = 0; ch < n_channels; ch++) {
+        List *group = get_group_by_channel(ch);
+        Int *first = group != NULL ? list_get_at(group, 0) : NULL;
+        fading_src[ch] = first != NULL ? first->val : ch;
+    }
+}
+
+static void verify_cb(AdaComError err, const double *previous, int n,
+        int mismatches)
+{
+    if (err != ADACOM_OK) {
+        log_error("Unable to verify the attenuations!");
+        tui_adacom_state(adacom_state());
+        desired_pending = false;
+        return;
+    }
+    if (mismatches > 0) {
+        double values[n];
+        adacom_get_all(values, n);
+        log_warn("Attenuation of %i channel(s) has been changed outside of "
+                "adacon!", mismatches);
+        tui_set_attenuations(values, n);
+        publish_applied();
+        if (cfg.verify.repush && !kill_pending && !fading_active) {
+            // Entries of requests which came in during the verification
+            // differ from the previous mirror, they are kept.
+            bool requested = desired_pending;
+            double *target = get_desired();
+            for (int ch = 0; ch < n; ch++) {
+                if (values[ch] != previous[ch]
+                        && (!requested || target[ch] == previous[ch])) {
+                    target[ch] = previous[ch];
+                }
+            }
+        }
+    }
+    // Requests which came in during the verification
+    apply_desired();
+}
+
+static void verify_timer_cb(MlTimer *timer, void *arg)
+{
+    if (adacom_state() != ADACOM_STATE_CONNECTED)
+        return;
+    // Only read back the device in idle gaps, never during a playback
+    if (state != ADACON_STATE_STOPPED || desired_pending
+            || adacom_idle_time() < cfg.verify.idle) {
+        ml_timer_in(verify_timer, cfg.verify.idle);
+        return;
+    }
+    adacom_verify(verify_cb);
+    ml_timer_in(verify_timer, cfg.verify.interval);
+}
+
+static void apply_profile(void)
+{
+    AdaProfile profile;
+    if (!profile_load(adacom_model(), &profile)) {
+        adacom_set_timeout(ADACOM_TIMEOUT);
+        lead_estimate = 0;
+        return;
+    }
+    // Leave enough headroom above the slowest measured answer
+    int timeout = profile.set_max * PROFILE_TIMEOUT_FACTOR;
+    if (timeout < PROFILE_TIMEOUT_MIN) {
+        timeout = PROFILE_TIMEOUT_MIN;
+    }
+    adacom_set_timeout(timeout);
+    lead_estimate = profile.set_p50;
+    log_info("Timing profile of %s: set p50 %.2f ms, p99 %.2f ms, "
+            "timeout %i ms.", adacom_model(), profile.set_p50,
+            profile.set_p99, timeout);
+    // In the worst case every channel changes in every tick
+    int rate = cfg.sample_rate * n_channels;
+    if (profile.max_rate > 0 && rate > profile.max_rate) {
+        log_warn("A sample rate of %i Hz needs up to %i commands/s, the "
+                "device sustains %.0f commands/s.", cfg.sample_rate, rate,
+                profile.max_rate);
+    }
+}
+
+static bool is_journalled_device(void)
+{
+    if (!restored.has_device)
+        return true;
+    // The journal keeps truncated ids
+    return restored.num_channels == n_channels
+            && strncmp(restored.model, adacom_model(), JOURNAL_ID_SIZE - 1) == 0
+            && strncmp(restored.sn, adacom_sn(), JOURNAL_ID_SIZE - 1) == 0;
+}
+
 static void connect_cb(AdaComError err)
 {
     if (err == ADACOM_OK) {
+        // Requests of a previous link have no completion to wait for
+        kill_pending = false;
+        desired_pending = false;
         current_channel = -1;
         ho_ctrl_ch_idx = -1;
         n_channels = adacom_num_channels();
         init_control_channels();
+        init_send_order();
+        apply_profile();
+        if (cfg.verify.interval > 0) {
+            ml_timer_in(verify_timer, cfg.verify.interval);
+        }
+        if (shm_enabled) {
+            shm_set_num_channels(n_channels);
+            for (int ch = 0; ch < ADACOM_MAX_CHANNELS; ch++) {
+                shm_last[ch] = -1;
+            }
+            shm_generation = 0;
+            publish_applied();
+        }
         tui_adacom_infos(adacom_model(), adacom_sn(), n_channels);
         log_info("Connected to %s (%s) with %i channels.",
                 adacom_model(), adacom_sn(), n_channels);
@@ -350,13 +1067,26 @@ static void connect_cb(AdaComError err)
         for (int ch = 0; ch < n_channels; ch++) {
             tui_set_attenuation(ch, adacom_get_channel(ch));
         }
-        // Synchronise groups if there are any defined
-        if (len(cfg.groups) > 0) {
+        init_fading_sources();
+        double applied[n_channels];
+        adacom_get_all(applied, n_channels);
+        if (fading_active) {
+            memcpy(base_values, applied, n_channels * sizeof(double));
+        }
+        if (restore_pending && !is_journalled_device()) {
+            log_warn("Device is not the one of the journal, the last run is "
+                    "not restored!");
+            restore_pending = false;
+        }
+        journal_device(adacom_model(), adacom_sn(), n_channels, applied);
+        if (restore_pending) {
+            resume_from_journal();
+        } else if (len(cfg.groups) > 0) {
+            // Synchronise groups if there are any defined
             double values[n_channels];
-            adacom_get_all(values, n_channels);
+            output_get(values);
             sync_grouped_channels(values);
-            adacom_set_all(values, n_channels, atten_set_all_cb);
-        } else {
+            output_set(values);
         }
     } else {
         tui_adacom_state(adacom_state());
@@ -376,10 +1106,261 @@ static void action_disconnect(int key) {
     log_info("Disconnect from %s (%s).", adacom_model(), adacom_sn());
     tui_select_channel(-1);
     adacom_disconnect();
+    kill_pending = false;
+    desired_pending = false;
     tui_adacom_state(adacom_state());
     tui_adacom_infos(NULL, NULL, 0);
 }
 
+static void stream_reset(void)
+{
+    for (int ch = 0; ch < ADACOM_MAX_CHANNELS; ch++) {
+        stream_last[ch] = -1;
+    }
+    stream_interval = 1000 / cfg.sample_rate;
+}
+
+static void stream_set(int ch, double value, double **values)
+{
+    if (ch < 0 || ch >= n_channels)
+        return;
+    // Values which are unchanged after quantisation are skipped
+    double atten = quantize_attenuation(value);
+    if (atten == stream_last[ch])
+        return;
+    if (*values == NULL) {
+        *values = get_desired();
+    }
+    set_all_in_same_group(ch, *values, atten);
+    stream_last[ch] = atten;
+}
+
+static void series_cb(MlTimer *timer, void *arg)
+{
+    int n_cols = series_num_columns();
+    double cols[n_cols];
+    double t = (run_time() - series_start) / 1000.0;
+    if (!series_sample(t, cols, n_cols)) {
+        log_info("Playback of '%s' finished.", cfg.playback_file);
+        state = ADACON_STATE_STOPPED;
+        return;
+    }
+    double *values = NULL;
+    for (int i = 0; i < n_cols; i++) {
+        stream_set(series_chs[i], cols[i], &values);
+    }
+    timer_add(series_timer, stream_interval);
+}
+
+static void start_playback(int elapsed)
+{
+    // Map the columns of the series to channels
+    for (int i = 0; i < SERIES_MAX_COLUMNS; i++) {
+        if (cfg.playback_channels == NULL) {
+            series_chs[i] = i;
+        } else if (i < len(cfg.playback_channels)) {
+            Int *ch = list_get_at(cfg.playback_channels, i);
+            series_chs[i] = ch->val;
+        } else {
+            series_chs[i] = -1;
+        }
+    }
+    stream_reset();
+    series_rewind();
+    series_start = mloop_run_time() - elapsed;
+    state = ADACON_STATE_PLAY_SERIES;
+    log_info("Playback of '%s' started.", cfg.playback_file);
+    series_cb(series_timer, NULL);
+}
+
+static void action_playback(int key)
+{
+    if (state == ADACON_STATE_PLAY_SERIES) {
+        log_info("Playback of '%s' stopped.", cfg.playback_file);
+        ml_timer_cancle(series_timer);
+        state = ADACON_STATE_STOPPED;
+        return;
+    }
+    if (!series_loaded || state != ADACON_STATE_STOPPED ||
+            adacom_state() != ADACOM_STATE_CONNECTED)
+        return;
+    start_playback(0);
+}
+
+static void mobility_cb(MlTimer *timer, void *arg)
+{
+    int n = cfg.mobility.n_aps;
+    double path_loss[n];
+    double t = (run_time() - mobility_start) / 1000.0;
+    bool cont = mobility_path_loss(t, path_loss, n);
+    // Channel i is fed by access point i, grouped channels follow it
+    double *values = NULL;
+    for (int ch = 0; ch < n; ch++) {
+        stream_set(ch, path_loss[ch], &values);
+    }
+    if (cont) {
+        timer_add(mobility_timer, stream_interval);
+    } else {
+        log_info("Mobility model reached its last waypoint.");
+        state = ADACON_STATE_STOPPED;
+    }
+}
+
+static void start_mobility(int elapsed)
+{
+    stream_reset();
+    mobility_start = mloop_run_time() - elapsed;
+    state = ADACON_STATE_PLAY_MOBILITY;
+    log_info("Mobility model started with %i APs.", cfg.mobility.n_aps);
+    mobility_cb(mobility_timer, NULL);
+}
+
+static void action_mobility(int key)
+{
+    if (state == ADACON_STATE_PLAY_MOBILITY) {
+        log_info("Mobility model stopped.");
+        ml_timer_cancle(mobility_timer);
+        state = ADACON_STATE_STOPPED;
+        return;
+    }
+    if (!mobility_loaded || state != ADACON_STATE_STOPPED ||
+            adacom_state() != ADACOM_STATE_CONNECTED)
+        return;
+    start_mobility(0);
+}
+
+static void journal_player_state(void)
+{
+    // Keep the interrupted playback until it has been resumed
+    if (restore_pending)
+        return;
+    JournalPlayer player = { .state = state, .channel = -1 };
+    if (state == ADACON_STATE_PLAY_SINGLE || state == ADACON_STATE_ARMED) {
+        player.channel = ctrl_chs[ho_ctrl_ch_idx];
+    }
+    if (state == ADACON_STATE_PLAY_SINGLE) {
+        player.elapsed = run_time() - ho_start;
+    } else if (state == ADACON_STATE_PLAY_SERIES) {
+        player.elapsed = run_time() - series_start;
+    } else if (state == ADACON_STATE_PLAY_MOBILITY) {
+        player.elapsed = run_time() - mobility_start;
+    }
+    journal_player(&player);
+}
+
+static void journal_timer_cb(MlTimer *timer, void *arg)
+{
+    ml_timer_add(journal_timer, JOURNAL_PLAYER_INTERVAL);
+    journal_player_state();
+}
+
+static void resume_player(const JournalPlayer *player)
+{
+    if (player->state == ADACON_STATE_PLAY_SINGLE) {
+        if (player->channel < 0 || player->channel >= n_channels
+                || !start_single_handoff(player->channel))
+            return;
+        // Continue the fade where it has been interrupted
+        ho_start = run_time() - player->elapsed;
+        ho_tick = player->elapsed / ho_interval + 1;
+        log_info("Handoff to channel %i resumed after %i ms.",
+                player->channel + 1, player->elapsed);
+    } else if (player->state == ADACON_STATE_PLAY_SERIES && series_loaded) {
+        log_info("Resume the playback after %i ms.", player->elapsed);
+        start_playback(player->elapsed);
+    } else if (player->state == ADACON_STATE_PLAY_MOBILITY
+            && mobility_loaded) {
+        log_info("Resume the mobility model after %i ms.", player->elapsed);
+        start_mobility(player->elapsed);
+    } else if (player->state != ADACON_STATE_STOPPED) {
+        log_warn("%s of the last run has not been resumed!",
+                state_to_cstr[player->state]);
+    }
+}
+
+static void resume_journal_player(void)
+{
+    restore_pending = false;
+    if (restored.player.state >= 0
+            && restored.player.state < ARRAY_LEN(state_to_cstr)) {
+        resume_player(&restored.player);
+    }
+}
+
+static void restore_set_all_cb(AdaComError err, double *values, int n)
+{
+    atten_set_all_cb(err, values, n);
+    if (err != ADACOM_OK) {
+        log_warn("Requested values of the last run have not been restored, "
+                "its playback is not resumed!");
+        restore_pending = false;
+        return;
+    }
+    resume_journal_player();
+}
+
+static void resume_from_journal(void)
+{
+    if (!restored.has_requested || restored.num_channels != n_channels) {
+        resume_journal_player();
+        return;
+    }
+    // The mirror holds the values just read from the device, so only the
+    // channels which differ are sent. The player continues afterwards.
+    AdaComError err = adacom_set_all(restored.requested, n_channels,
+            restore_set_all_cb);
+    journal_target(err);
+    if (err != ADACOM_OK) {
+        log_warn("Unable to restore the requested values of the last run!");
+        restore_pending = false;
+    } else if (!adacom_is_busy()) {
+        // Nothing to send, the device already has the values
+        resume_journal_player();
+    }
+}
+
+static void fading_cb(MlTimer *timer, void *arg)
+{
+    if (device_connected()) {
+        double target[n_channels], out[n_channels];
+        device_get_target(target);
+        output_apply_fading(base_values, out);
+        // Only trigger a device update if a quantised value has changed
+        for (int ch = 0; ch < n_channels; ch++) {
+            if (out[ch] != target[ch]) {
+                get_desired();
+                break;
+            }
+        }
+    }
+    timer_add(fading_timer, fading_interval);
+}
+
+static void action_fading(int key)
+{
+    if (!fading_loaded || adacom_state() != ADACOM_STATE_CONNECTED)
+        return;
+    if (fading_active) {
+        // Go back to the values without fading, the desired vector holds
+        // the base values while the overlay is active.
+        get_desired();
+        ml_timer_cancle(fading_timer);
+        fading_active = false;
+        log_info("Fading overlay disabled.");
+        return;
+    }
+    adacom_get_target(base_values, n_channels);
+    fading_start = mloop_run_time();
+    fading_active = true;
+    ml_timer_in(fading_timer, fading_interval);
+    log_info("Fading overlay enabled (seed %lu).",
+            (unsigned long)cfg.fading.seed);
+}
+
+static void action_toggle_dashboard(int key) {
+    tui_toggle_dashboard();
+}
+
 static void action_show_config(int key) {
     if (cfg.file_path != NULL) {
         log_info("file: %s", cfg.file_path);
@@ -392,11 +1373,500 @@ static void action_show_config(int key) {
             cfg.sample_rate, cfg.action_time, cfg.recovery_time);
 }
 
+static int replay(const char *path)
+{
+    adacom_init(cfg.ada.device);
+    AdaComError err = adacom_replay(path, NULL);
+    adacom_dump_hists(stdout);
+    adacom_destroy();
+    return err == ADACOM_OK ? 0 : 1;
+}
+
+static void recovery_cb(MlTimer *timer, void *arg)
+{
+    // Next handoff of a continuous sequence
+    if (start_single_handoff(current_channel)) {
+        ho_count++;
+    }
+}
+
+static void start_streams(void)
+{
+    stream_reset();
+    if (series_loaded) {
+        for (int i = 0; i < SERIES_MAX_COLUMNS; i++) {
+            series_chs[i] = i < n_channels ? i : -1;
+        }
+        series_rewind();
+        series_start = run_time();
+        state = ADACON_STATE_PLAY_SERIES;
+        series_cb(series_timer, NULL);
+    } else if (mobility_loaded) {
+        mobility_start = run_time();
+        state = ADACON_STATE_PLAY_MOBILITY;
+        mobility_cb(mobility_timer, NULL);
+    }
+}
+
+static void publish_applied(void)
+{
+    if (!shm_enabled)
+        return;
+    double values[n_channels];
+    adacom_get_all(values, n_channels);
+    shm_publish_applied(values, n_channels, shm_submitted_gen);
+}
+
+static void shm_timer_cb(MlTimer *timer, void *arg)
+{
+    uint64_t gen;
+    double values[ADACOM_MAX_CHANNELS];
+    if (adacom_state() == ADACOM_STATE_CONNECTED
+            && state == ADACON_STATE_STOPPED
+            && shm_read_desired(values, n_channels, &gen)
+            && gen != shm_generation) {
+        // Only take over the channels the producer has changed
+        double *desired_values = get_desired();
+        for (int ch = 0; ch < n_channels; ch++) {
+            if (values[ch] != shm_last[ch]) {
+                desired_values[ch] = limit_attenuation(values[ch]);
+                shm_last[ch] = values[ch];
+            }
+        }
+        shm_generation = gen;
+    }
+    ml_timer_add(shm_timer, 1000 / cfg.sample_rate);
+}
+
+static void append_state(Str *reply)
+{
+    char buf[16];
+    Str head = init(Str, "{\"adacom\": \"%s\", \"player\": \"%s\", "
+            "\"attenuations\": [", adacom_state_to_cstr(adacom_state()),
+            state_to_cstr[state]);
+    str_append(reply, head.cstr);
+    destroy(&head);
+    for (int ch = 0; ch < n_channels; ch++) {
+        snprintf(buf, sizeof(buf), "%s%.2f", ch > 0 ? ", " : "",
+                adacom_get_channel(ch));
+        str_append(reply, buf);
+    }
+    str_append(reply, "]}");
+}
+
+static bool control_request_cb(const CtrlRequest *req, Str *reply)
+{
+    if (req->cmd == CTRL_CMD_STATE) {
+        append_state(reply);
+        return true;
+    }
+    if (adacom_state() != ADACOM_STATE_CONNECTED) {
+        str_append(reply, "not connected");
+        return false;
+    }
+    if (state != ADACON_STATE_STOPPED) {
+        str_append(reply, "handoff is running");
+        return false;
+    }
+    for (int i = 0; i < req->n; i++) {
+        if (req->channels[i] < 0 || req->channels[i] >= n_channels) {
+            str_append(reply, "invalid channel");
+            return false;
+        }
+    }
+    if (req->cmd == CTRL_CMD_VECTOR && req->n != n_channels) {
+        str_append(reply, "invalid number of values");
+        return false;
+    }
+    if (req->cmd == CTRL_CMD_HANDOFF) {
+        if (req->at_ns > 0) {
+            clockid_t clock = req->realtime ? CLOCK_REALTIME : CLOCK_MONOTONIC;
+            return arm_handoff(req->channels[0], clock, req->at_ns);
+        }
+        return start_single_handoff(req->channels[0]);
+    }
+    // All value changes of this loop iteration are sent in one update.
+    double *values = get_desired();
+    for (int i = 0; i < req->n; i++) {
+        double atten = limit_attenuation(req->values[i]);
+        if (req->cmd == CTRL_CMD_GROUP) {
+            set_all_in_same_group(req->channels[i], values, atten);
+        } else {
+            values[req->channels[i]] = atten;
+        }
+    }
+    return true;
+}
+
+static void load_sources(void)
+{
+    if (cfg.playback_file != NULL) {
+        series_loaded = series_open(cfg.playback_file);
+        if (!series_loaded) {
+            log_error("Unable to load series '%s'!", cfg.playback_file);
+        }
+    }
+    if (cfg.mobility.n_aps > 0) {
+        MobilityConfig *mc = &cfg.mobility;
+        mobility_loaded = mobility_init(&mc->params, mc->aps, mc->n_aps,
+                mc->waypoints, mc->n_waypoints);
+        if (!mobility_loaded) {
+            log_error("Invalid mobility configuration!");
+        }
+    }
+    if (cfg.fading.sigma > 0) {
+        fading_interval = 1000 / cfg.sample_rate;
+        fading_loaded = fading_init(cfg.fading.seed, cfg.fading.sigma,
+                cfg.fading.correlation_time, fading_interval);
+        if (!fading_loaded) {
+            log_error("Invalid fading configuration!");
+        }
+    }
+}
+
+static void new_timers(void)
+{
+    play_timer = new(MlTimer, player_cb, NULL);
+    arm_timer = new(MlTimer, arm_timer_cb, NULL);
+    desired_timer = new(MlTimer, desired_timer_cb, NULL);
+    shm_timer = new(MlTimer, shm_timer_cb, NULL);
+    series_timer = new(MlTimer, series_cb, NULL);
+    mobility_timer = new(MlTimer, mobility_cb, NULL);
+    fading_timer = new(MlTimer, fading_cb, NULL);
+    recovery_timer = new(MlTimer, recovery_cb, NULL);
+    verify_timer = new(MlTimer, verify_timer_cb, NULL);
+    journal_timer = new(MlTimer, journal_timer_cb, NULL);
+}
+
+static void delete_timers(void)
+{
+    delete(journal_timer);
+    delete(verify_timer);
+    delete(recovery_timer);
+    delete(fading_timer);
+    delete(mobility_timer);
+    delete(series_timer);
+    delete(shm_timer);
+    delete(desired_timer);
+    delete(arm_timer);
+    delete(play_timer);
+}
+
+/*
+ * Offline planner: expand a scenario into the device commands of each tick,
+ * as if every command was confirmed in time, and check them against the
+ * serial link.
+ */
+typedef struct {
+    SimParams params;
+    int interval;
+    double device[ADACOM_MAX_CHANNELS];
+    int ticks;
+    int overruns;
+    unsigned long cmds;
+    unsigned long bytes;
+    double tick_ms_sum;
+    double tick_ms_max;
+    // Commands and bytes of the ticks within the last second
+    int win_cmds[CFG_SAMPLE_RATE_MAX];
+    int win_bytes[CFG_SAMPLE_RATE_MAX];
+    int win_cmds_sum;
+    int win_bytes_sum;
+    int peak_cmds;
+    int peak_bytes;
+} Plan;
+
+// Limit for scenarios which do not end by themselves
+#define PLAN_MAX_TIME (3600 * 1000)
+
+static void plan_tick(Plan *p, int t, const char *what, const double *values)
+{
+    int cmds = 0;
+    int bytes = 0;
+    double ms = 0;
+    for (int ch = 0; ch < n_channels; ch++) {
+        double atten = sim_validate_attenuation(values[ch]);
+        if (atten == p->device[ch])
+            continue;
+        int b;
+        ms += sim_cmd_time(&p->params, ch, atten, &b);
+        bytes += b;
+        cmds++;
+        p->device[ch] = atten;
+    }
+    int slot = p->ticks++ % cfg.sample_rate;
+    p->win_cmds_sum += cmds - p->win_cmds[slot];
+    p->win_bytes_sum += bytes - p->win_bytes[slot];
+    p->win_cmds[slot] = cmds;
+    p->win_bytes[slot] = bytes;
+    if (p->win_cmds_sum > p->peak_cmds) {
+        p->peak_cmds = p->win_cmds_sum;
+    }
+    if (p->win_bytes_sum > p->peak_bytes) {
+        p->peak_bytes = p->win_bytes_sum;
+    }
+    p->cmds += cmds;
+    p->bytes += bytes;
+    p->tick_ms_sum += ms;
+    if (ms > p->tick_ms_max) {
+        p->tick_ms_max = ms;
+    }
+    if (ms > p->interval) {
+        p->overruns++;
+        printf("overrun at %9.3f s (%s): %i commands, %i bytes, "
+                "%.2f ms > %i ms\n", t / 1000.0, what, cmds, bytes, ms,
+                p->interval);
+    }
+}
+
+static void plan_start(Plan *p, double *values)
+{
+    for (int ch = 0; ch < n_channels; ch++) {
+        p->device[ch] = sim_validate_attenuation(values[ch]);
+    }
+}
+
+static void plan_handoffs(Plan *p)
+{
+    double values[n_channels];
+    char what[32];
+    // Steady state of a sequence: the last control channel is served
+    for (int ch = 0; ch < n_channels; ch++) {
+        values[ch] = cfg.max_attenuation;
+    }
+    set_all_in_same_group(ctrl_chs[n_ctrl_chs - 1], values,
+            cfg.min_attenuation);
+    plan_start(p, values);
+    int t = 0;
+    for (int i = 0; i < n_ctrl_chs; i++) {
+        int solo_ch = ctrl_chs[i];
+        snprintf(what, sizeof(what), "handoff to %i", solo_ch + 1);
+        for (int ho_time = p->interval; ; ho_time += p->interval) {
+            double solo_val = handoff_atten(ho_time);
+            if (solo_val < values[solo_ch]) {
+                set_solo_and_others(solo_ch, solo_val, values);
+            }
+            plan_tick(p, t + ho_time, what, values);
+            if (ho_time >= cfg.action_time)
+                break;
+        }
+        t += cfg.action_time + cfg.recovery_time;
+    }
+}
+
+static void plan_stream(Plan *p, bool series)
+{
+    int n = series ? series_num_columns() : cfg.mobility.n_aps;
+    double path_loss[n];
+    double values[n_channels];
+    for (int ch = 0; ch < n_channels; ch++) {
+        values[ch] = cfg.max_attenuation;
+    }
+    plan_start(p, values);
+    series_rewind();
+    for (int t = 0; t < PLAN_MAX_TIME; t += p->interval) {
+        bool cont;
+        if (series) {
+            cont = series_sample(t / 1000.0, path_loss, n);
+            if (!cont)
+                break;
+        } else {
+            cont = mobility_path_loss(t / 1000.0, path_loss, n);
+        }
+        for (int i = 0; i < n && i < n_channels; i++) {
+            set_all_in_same_group(i, values,
+                    quantize_attenuation(path_loss[i]));
+        }
+        plan_tick(p, t, series ? "playback" : "mobility", values);
+        if (!cont)
+            break;
+    }
+}
+
+static int plan(void)
+{
+    Plan p = {
+        .params = {
+            .num_channels = cfg.simulation.channels,
+            .baudrate = ADACOM_BAUDRATE,
+            .cmd_latency = cfg.simulation.cmd_latency
+        },
+        .interval = 1000 / cfg.sample_rate
+    };
+    const char *scenario = cfg.cmd.argc > 0 ? cfg.cmd.argv[0] : NULL;
+    load_sources();
+    n_channels = p.params.num_channels;
+    init_control_channels();
+    if (scenario == NULL) {
+        scenario = series_loaded ? "playback"
+                : mobility_loaded ? "mobility" : "handoff";
+    }
+    if (strcmp(scenario, "handoff") == 0 && n_ctrl_chs > 0) {
+        plan_handoffs(&p);
+    } else if (strcmp(scenario, "playback") == 0 && series_loaded) {
+        plan_stream(&p, true);
+    } else if (strcmp(scenario, "mobility") == 0 && mobility_loaded) {
+        plan_stream(&p, false);
+    } else {
+        fprintf(stderr, "Unable to plan scenario '%s'!\n", scenario);
+        series_close();
+        return 1;
+    }
+    series_close();
+    double secs = p.ticks * p.interval / 1000.0;
+    int budget = ADACOM_BAUDRATE / 10;
+    printf("scenario: %s, %i channels, %i ms ticks, %.1f s\n", scenario,
+            n_channels, p.interval, secs);
+    printf("commands: %lu, bytes: %lu\n", p.cmds, p.bytes);
+    printf("commands/s: average %.1f, peak %i\n",
+            secs > 0 ? p.cmds / secs : 0, p.peak_cmds);
+    printf("bytes/s: average %.1f, peak %i of %i (%.1f %%)\n",
+            secs > 0 ? p.bytes / secs : 0, p.peak_bytes, budget,
+            100.0 * p.peak_bytes / budget);
+    printf("tick latency [ms]: average %.2f, max %.2f of %i\n",
+            p.ticks > 0 ? p.tick_ms_sum / p.ticks : 0, p.tick_ms_max,
+            p.interval);
+    printf("overrunning ticks: %i of %i\n", p.overruns, p.ticks);
+    return p.overruns > 0 || p.peak_bytes > budget ? 2 : 0;
+}
+
+// The simulated timers call back without MlTimer
+static void sim_player_cb(void *timer, void *arg)
+{
+    player_cb(timer, arg);
+}
+
+static void sim_recovery_cb(void *timer, void *arg)
+{
+    recovery_cb(timer, arg);
+}
+
+static void sim_desired_timer_cb(void *timer, void *arg)
+{
+    desired_timer_cb(timer, arg);
+}
+
+static void sim_series_cb(void *timer, void *arg)
+{
+    series_cb(timer, arg);
+}
+
+static void sim_mobility_cb(void *timer, void *arg)
+{
+    mobility_cb(timer, arg);
+}
+
+static void sim_fading_cb(void *timer, void *arg)
+{
+    fading_cb(timer, arg);
+}
+
+static int simulate(void)
+{
+    SimParams params = {
+        .num_channels = cfg.simulation.channels,
+        .baudrate = ADACOM_BAUDRATE,
+        .cmd_latency = cfg.simulation.cmd_latency
+    };
+    int duration = cfg.simulation.duration * 1000;
+    uint64_t wall_start = clock_ns(CLOCK_MONOTONIC);
+    load_sources();
+    new_timers();
+    sim_init(&params, stdout);
+    sim_set_applied_cb(applied_cb);
+    sim_timer_new(play_timer, sim_player_cb);
+    sim_timer_new(recovery_timer, sim_recovery_cb);
+    sim_timer_new(desired_timer, sim_desired_timer_cb);
+    sim_timer_new(series_timer, sim_series_cb);
+    sim_timer_new(mobility_timer, sim_mobility_cb);
+    sim_timer_new(fading_timer, sim_fading_cb);
+    simulating = true;
+    n_channels = params.num_channels;
+    lead_estimate = sim_cmd_time(&params, 0, cfg.pivot_attenuation, NULL);
+    init_control_channels();
+    init_send_order();
+    init_fading_sources();
+    if (fading_loaded) {
+        for (int ch = 0; ch < n_channels; ch++) {
+            base_values[ch] = ADACOM_MAX_ATTENUATION;
+        }
+        fading_start = 0;
+        fading_active = true;
+        timer_in(fading_timer, fading_interval);
+    }
+    // A streamed scenario if one is configured, endless handoffs otherwise
+    if (series_loaded || mobility_loaded) {
+        start_streams();
+    } else if (n_ctrl_chs > 0) {
+        ho_continuous = true;
+        if (start_single_handoff(next_ho_channel())) {
+            ho_count++;
+        }
+    } else {
+        log_error("Nothing to simulate, no channels configured!");
+    }
+    sim_run(duration);
+    const SimStats *stats = sim_get_stats();
+    double secs = sim_run_time() / 1000.0;
+    double wall = (clock_ns(CLOCK_MONOTONIC) - wall_start) / 1e9;
+    double bytes = stats->bytes_tx + stats->bytes_rx;
+    fprintf(stdout, "# simulated: %.1f s in %.3f s\n", secs, wall);
+    fprintf(stdout, "# handoffs: %i\n", ho_count);
+    fprintf(stdout, "# commands: %lu (%.1f/s), rejected while busy: %lu\n",
+            stats->cmds, secs > 0 ? stats->cmds / secs : 0, stats->busy);
+    fprintf(stdout, "# bytes: tx %lu, rx %lu (%.1f B/s of %i B/s)\n",
+            stats->bytes_tx, stats->bytes_rx, secs > 0 ? bytes / secs : 0,
+            ADACOM_BAUDRATE / 10);
+    fprintf(stdout, "# device busy: %.1f %%\n",
+            secs > 0 ? stats->busy_time / (secs * 10) : 0);
+    fprintf(stdout, "# latency [ms]: mean %.2f, p50 %.2f, p99 %.2f, "
+            "max %.2f\n", hist_mean(&stats->latency) / 1000.0,
+            hist_percentile(&stats->latency, 50) / 1000.0,
+            hist_percentile(&stats->latency, 99) / 1000.0,
+            stats->latency.max / 1000.0);
+    simulating = false;
+    sim_destroy();
+    delete_timers();
+    series_close();
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     cfg_init(argc, argv);
     log_init(cfg.log_level);
     mloop_init();
+    dlog_init(cfg.log_level, cfg.lazy_debug_log);
+    if (cfg.replay_file != NULL) {
+        int ret = replay(cfg.replay_file);
+        dlog_destroy();
+        cfg_destroy();
+        return ret;
+    }
+    if (cfg.cmd.name != NULL) {
+        int ret;
+        if (strcmp(cfg.cmd.name, "plan") == 0) {
+            ret = plan();
+        } else if (strcmp(cfg.cmd.name, "characterise") == 0) {
+            ret = characterise_run();
+        } else {
+            ret = cli_run();
+        }
+        dlog_destroy();
+        cfg_destroy();
+        return ret;
+    }
+    if (cfg.simulation.duration > 0) {
+        int ret = simulate();
+        dlog_destroy();
+        cfg_destroy();
+        return ret;
+    }
+    if (cfg.trace_file != NULL && !trace_open(cfg.trace_file)) {
+        fprint(stderr, "Unable to open trace file '%s'!\n", cfg.trace_file);
+        cfg_destroy();
+        return 1;
+    }
     tui_init();
     tui_add_action('x', action_disconnect);
     tui_add_action('c', action_connect);
@@ -412,16 +1882,80 @@ int main(int argc, char *argv[])
     tui_add_action(TUI_KEY_RIGHT, action_shift_ch_right);
     tui_add_action(TUI_KEY_LEFT, action_shift_ch_left);
     tui_add_action('C', action_show_config);
+    tui_add_action('d', action_toggle_dashboard);
+    tui_add_action('p', action_playback);
+    tui_add_action('u', action_mobility);
+    tui_add_action('f', action_fading);
     tui_add_num_action(action_select_ch);
+    if (cfg.control_socket != NULL) {
+        if (!ctrl_init(cfg.control_socket, control_request_cb)) {
+            log_error("Remote control via '%s' is not available!",
+                    cfg.control_socket);
+        }
+    }
+    if (cfg.event_socket != NULL) {
+        events_enabled = events_init(cfg.event_socket);
+    }
+    if (cfg.metrics.file != NULL || cfg.metrics.port > 0) {
+        metrics_init(cfg.metrics.file, cfg.metrics.interval, cfg.metrics.port);
+    }
+    adacom_set_applied_cb(applied_cb);
+    load_sources();
+    if (cfg.shm_path != NULL) {
+        shm_enabled = shm_init(cfg.shm_path);
+        if (!shm_enabled) {
+            log_error("Unable to map shared memory '%s'!", cfg.shm_path);
+        }
+    }
+    if (cfg.journal_file != NULL) {
+        journal_enabled = journal_open(cfg.journal_file, &restored);
+        if (!journal_enabled) {
+            log_error("Unable to map journal '%s'!", cfg.journal_file);
+        }
+        restore_pending = restored.has_requested
+                || restored.player.state != ADACON_STATE_STOPPED;
+    }
     adacom_init(cfg.ada.device);
-    if (adacom_connect(connect_cb) != ADACOM_OK) {
+    adacom_set_io_thread(cfg.io_thread.enabled, cfg.io_thread.cpu,
+            cfg.io_thread.rt_priority);
+    new_timers();
+    if (restored.has_device) {
+        log_info("Restore %s (%s) from the journal.", restored.model,
+                restored.sn);
+    }
+    // The identity of the device is checked before anything is restored
+    AdaComError err = adacom_connect(connect_cb);
+    if (err != ADACOM_OK) {
         tui_adacom_state(adacom_state());
     }
-    play_timer = new(MlTimer, player_cb, NULL);
+    if (shm_enabled) {
+        ml_timer_in(shm_timer, 1000 / cfg.sample_rate);
+    }
+    if (journal_enabled) {
+        ml_timer_in(journal_timer, JOURNAL_PLAYER_INTERVAL);
+    }
     mloop_run();
-    delete(play_timer);
+    if (journal_enabled) {
+        // Last progress of a playback which is resumed on the next start
+        journal_player_state();
+        journal_close();
+    }
+    delete_timers();
+    series_close();
+    shm_destroy();
+    metrics_destroy();
+    events_destroy();
+    ctrl_destroy();
     adacom_destroy();
+    trace_close();
+    dlog_destroy();
     tui_destroy();
+    adacom_dump_hists(stderr);
+    if (trace_dropped() > 0) {
+        // A replay of the trace reports mismatches at these gaps
+        fprintf(stderr, "Trace is incomplete, %lu records have been "
+                "dropped!\n", trace_dropped());
+    }
     cfg_destroy();
     return 0;
 }
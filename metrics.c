@@ -0,0 +1,334 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <masc.h>
+
+#include "adacom.h"
+#include "hist.h"
+#include "serio.h"
+#include "trace.h"
+#include "metrics.h"
+
+#define METRICS_HTTP_HEADER "HTTP/1.0 200 OK\r\n" \
+        "Content-Type: text/plain; version=0.0.4\r\n" \
+        "Connection: close\r\n\r\n"
+// Time in ms a (local) scraper may block the loop while taking the response
+#define METRICS_SEND_TIMEOUT 100
+// Time in ms a client has to send its request
+#define METRICS_CLIENT_TIMEOUT 5000
+#define METRICS_MAX_CLIENTS 8
+
+
+typedef struct {
+    Io io;
+    int fd;
+    bool replied;
+    MlTimer *timer;
+} MetricsClient;
+
+
+// Upper bounds of the RTT histogram buckets in ms
+static const int rtt_buckets[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+
+static char *file_path = NULL;
+static char *tmp_path = NULL;
+static int file_interval;
+static MlTimer *file_timer = NULL;
+static Io server;
+static bool serving = false;
+static int n_clients = 0;
+static unsigned long handoffs = 0;
+static unsigned long overruns = 0;
+
+
+void metrics_count_handoff(void)
+{
+    handoffs++;
+}
+
+void metrics_count_overrun(void)
+{
+    overruns++;
+}
+
+static void write_counter(FILE *f, const char *name, const char *help,
+        unsigned long value)
+{
+    fprintf(f, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", name, help, name,
+            name, value);
+}
+
+static void write_rtt_hist(FILE *f, AdaComCmdType type)
+{
+    const Hist *h = adacom_cmd_hist(type);
+    const char *name = adacom_cmd_type_to_cstr(type);
+    // The histogram records us, the buckets are in ms
+    for (int i = 0; i < ARRAY_LEN(rtt_buckets); i++) {
+        fprintf(f, "adacon_rtt_ms_bucket{type=\"%s\",le=\"%i\"} %llu\n", name,
+                rtt_buckets[i], (unsigned long long)hist_count_le(h,
+                (uint64_t)rtt_buckets[i] * 1000));
+    }
+    fprintf(f, "adacon_rtt_ms_bucket{type=\"%s\",le=\"+Inf\"} %llu\n", name,
+            (unsigned long long)h->count);
+    fprintf(f, "adacon_rtt_ms_sum{type=\"%s\"} %.3f\n", name, h->sum / 1000);
+    fprintf(f, "adacon_rtt_ms_count{type=\"%s\"} %llu\n", name,
+            (unsigned long long)h->count);
+}
+
+static void write_group_skews(FILE *f)
+{
+    int n = adacom_num_groups();
+    if (n == 0)
+        return;
+    fprintf(f, "# HELP adacon_group_skew_ms Time between the first and the "
+            "last member change of a group.\n"
+            "# TYPE adacon_group_skew_ms summary\n");
+    for (int g = 0; g < n; g++) {
+        const Hist *h = adacom_group_skew_hist(g);
+        fprintf(f, "adacon_group_skew_ms{group=\"%i\",quantile=\"0.5\"} "
+                "%.3f\n", g + 1, hist_percentile(h, 50) / 1000.0);
+        fprintf(f, "adacon_group_skew_ms{group=\"%i\",quantile=\"0.99\"} "
+                "%.3f\n", g + 1, hist_percentile(h, 99) / 1000.0);
+        fprintf(f, "adacon_group_skew_ms_sum{group=\"%i\"} %.3f\n", g + 1,
+                h->sum / 1000);
+        fprintf(f, "adacon_group_skew_ms_count{group=\"%i\"} %llu\n", g + 1,
+                (unsigned long long)h->count);
+    }
+}
+
+static void write_metrics(FILE *f)
+{
+    AdaComStats stats;
+    adacom_get_stats(&stats);
+    fprintf(f, "# HELP adacon_commands_total Commands sent to the device.\n"
+            "# TYPE adacon_commands_total counter\n");
+    for (int type = 0; type < ADACOM_CMD_TYPES; type++) {
+        fprintf(f, "adacon_commands_total{type=\"%s\"} %lu\n",
+                adacom_cmd_type_to_cstr(type), stats.type_cmds[type]);
+    }
+    write_counter(f, "adacon_timeouts_total", "Commands without response.",
+            stats.timeouts);
+    write_counter(f, "adacon_connects_total", "Successful (re)connects.",
+            stats.connects);
+    write_counter(f, "adacon_busy_total", "Commands rejected while busy.",
+            stats.busy);
+    write_counter(f, "adacon_preemptions_total",
+            "Commands preempted by urgent requests.", stats.preemptions);
+    write_counter(f, "adacon_drifts_total",
+            "Verifications which found changed attenuations.", stats.drifts);
+    write_counter(f, "adacon_unacked_total",
+            "Set commands sent without acknowledgement.", stats.unacked);
+    write_counter(f, "adacon_unacked_lost_total",
+            "Unacknowledged set commands without reply.", stats.unacked_lost);
+    write_counter(f, "adacon_tx_bytes_total", "Bytes sent to the device.",
+            stats.bytes_tx);
+    write_counter(f, "adacon_rx_bytes_total", "Bytes received from the device.",
+            stats.bytes_rx);
+    write_counter(f, "adacon_io_dropped_total",
+            "Lines dropped by the I/O thread.", serio_dropped());
+    write_counter(f, "adacon_trace_dropped_total",
+            "Trace records dropped by the trace writer.", trace_dropped());
+    write_counter(f, "adacon_handoffs_total", "Completed handoffs.", handoffs);
+    write_counter(f, "adacon_tick_overruns_total",
+            "Player ticks late by at least one interval.", overruns);
+    bool connected = adacom_state() == ADACOM_STATE_CONNECTED;
+    fprintf(f, "# HELP adacon_connected Device connection state.\n"
+            "# TYPE adacon_connected gauge\nadacon_connected %i\n", connected);
+    if (connected) {
+        int n = adacom_num_channels();
+        double values[n];
+        adacom_get_all(values, n);
+        fprintf(f, "# HELP adacon_attenuation_db Current attenuation.\n"
+                "# TYPE adacon_attenuation_db gauge\n");
+        for (int ch = 0; ch < n; ch++) {
+            fprintf(f, "adacon_attenuation_db{channel=\"%i\"} %.2f\n", ch + 1,
+                    values[ch]);
+        }
+    }
+    fprintf(f, "# HELP adacon_rtt_ms Command round trip times.\n"
+            "# TYPE adacon_rtt_ms histogram\n");
+    for (int type = 0; type < ADACOM_CMD_TYPES; type++) {
+        write_rtt_hist(f, type);
+    }
+    write_group_skews(f);
+}
+
+static void write_file(void)
+{
+    // Write a temporary file and rename it, so that the node exporter never
+    // reads a partial file.
+    FILE *f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        log_warn("metrics: Unable to write '%s'!", tmp_path);
+        return;
+    }
+    write_metrics(f);
+    if (fclose(f) != 0 || rename(tmp_path, file_path) != 0) {
+        log_warn("metrics: Unable to update '%s'!", file_path);
+        unlink(tmp_path);
+    }
+}
+
+static void file_timer_cb(MlTimer *timer, void *arg)
+{
+    ml_timer_add(file_timer, file_interval);
+    write_file();
+}
+
+static bool send_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n > 0) {
+            buf += n;
+            len -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return false;
+        // The socket buffer is full, wait for the client to take the rest
+        struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+        if (poll(&pfd, 1, METRICS_SEND_TIMEOUT) <= 0)
+            return false;
+    }
+    return true;
+}
+
+static void client_line_cb(MlIoPkg *self, void *data, size_t size, void *arg)
+{
+    MetricsClient *client = arg;
+    // Any request is answered after its header, i.e. the first empty line
+    if (client->replied || (size > 0 && ((char *)data)[0] != '\r'))
+        return;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&buf, &len);
+    if (f == NULL)
+        return;
+    fputs(METRICS_HTTP_HEADER, f);
+    write_metrics(f);
+    fclose(f);
+    bool sent = send_all(client->fd, buf, len);
+    free(buf);
+    client->replied = true;
+    if (!sent) {
+        log_warn("metrics: Unable to send the response!");
+        shutdown(client->fd, SHUT_RDWR);
+        return;
+    }
+    // The client closes the connection after the response
+    shutdown(client->fd, SHUT_WR);
+}
+
+static void client_eof_cb(MlIoReader *self, void *arg)
+{
+    MetricsClient *client = arg;
+    delete(client->timer);
+    destroy(&client->io);
+    free(client);
+    n_clients--;
+}
+
+static void client_timer_cb(MlTimer *timer, void *arg)
+{
+    MetricsClient *client = arg;
+    log_debug("metrics: Client did not send a request in time.");
+    // Reported as EOF, which frees the client
+    shutdown(client->fd, SHUT_RDWR);
+}
+
+static void server_cb(MlIo *self, int fd, ml_io_flag_t events, void *arg)
+{
+    if (!(events & ML_IO_READ))
+        return;
+    int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) {
+        log_warn("metrics: Unable to accept client!");
+        return;
+    }
+    if (n_clients >= METRICS_MAX_CLIENTS) {
+        log_warn("metrics: Too many clients!");
+        close(client_fd);
+        return;
+    }
+    MetricsClient *client = malloc(sizeof(MetricsClient));
+    client->io = init(Io, client_fd);
+    client->fd = client_fd;
+    client->replied = false;
+    client->timer = new(MlTimer, client_timer_cb, client);
+    ml_timer_in(client->timer, METRICS_CLIENT_TIMEOUT);
+    n_clients++;
+    mloop_io_pkg_new(&client->io, '\n', client_line_cb, client_eof_cb, client);
+}
+
+static bool listen_http(int port)
+{
+    // Only local scrapers, e.g. an exporter proxy or an SSH tunnel
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_error("metrics: Unable to create socket!");
+        return false;
+    }
+    server = init(Io, fd);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || listen(fd, 4) < 0) {
+        log_error("metrics: Unable to listen on port %i!", port);
+        destroy(&server);
+        return false;
+    }
+    mloop_io_new(&server, ML_IO_READ, server_cb, NULL);
+    log_info("metrics: Serving http://127.0.0.1:%i/metrics.", port);
+    return true;
+}
+
+bool metrics_init(const char *file, int interval, int port)
+{
+    bool ok = true;
+    if (port > 0) {
+        serving = listen_http(port);
+        ok = serving;
+    }
+    if (file != NULL) {
+        file_path = strdup(file);
+        asprintf(&tmp_path, "%s.tmp", file);
+        file_interval = interval;
+        file_timer = new(MlTimer, file_timer_cb, NULL);
+        ml_timer_in(file_timer, file_interval);
+        log_info("metrics: Writing '%s' every %i ms.", file, interval);
+    }
+    return ok;
+}
+
+void metrics_destroy(void)
+{
+    if (serving) {
+        destroy(&server);
+        serving = false;
+    }
+    if (file_timer != NULL) {
+        delete(file_timer);
+        file_timer = NULL;
+        // Final state of this run
+        write_file();
+        free(tmp_path);
+        free(file_path);
+        tmp_path = NULL;
+        file_path = NULL;
+    }
+}
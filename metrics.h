@@ -0,0 +1,20 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdbool.h>
+
+/*
+ * Prometheus metrics of the device link and the handoff player. They are
+ * written atomically to a node exporter textfile and/or served on
+ * http://127.0.0.1:<port>/metrics.
+ */
+
+
+bool metrics_init(const char *file, int interval, int port);
+void metrics_destroy(void);
+
+// Counters of the main loop (plain increments, nothing else on the hot path)
+void metrics_count_handoff(void);
+void metrics_count_overrun(void);
+
+#endif /* _METRICS_H_ */
@@ -0,0 +1,81 @@
+#include <math.h>
+
+#include "mobility.h"
+
+
+static MobParams mp;
+// The access points are kept as separate coordinate arrays for the kernel
+static double ap_x[ADACOM_MAX_CHANNELS];
+static double ap_y[ADACOM_MAX_CHANNELS];
+static int num_aps = 0;
+static MobPoint wps[MOBILITY_MAX_WAYPOINTS];
+static double wp_dist[MOBILITY_MAX_WAYPOINTS];
+static int num_wps = 0;
+
+
+bool mobility_init(const MobParams *params, const MobPoint *aps, int n_aps,
+        const MobPoint *waypoints, int n_waypoints)
+{
+    if (n_aps < 1 || n_aps > ADACOM_MAX_CHANNELS || n_waypoints < 1
+            || n_waypoints > MOBILITY_MAX_WAYPOINTS || params->pl_d0 <= 0)
+        return false;
+    mp = *params;
+    for (int i = 0; i < n_aps; i++) {
+        ap_x[i] = aps[i].x;
+        ap_y[i] = aps[i].y;
+    }
+    num_aps = n_aps;
+    // Cumulative distance along the path at each waypoint
+    for (int i = 0; i < n_waypoints; i++) {
+        wps[i] = waypoints[i];
+        wp_dist[i] = i == 0 ? 0 : wp_dist[i - 1] + hypot(
+                wps[i].x - wps[i - 1].x, wps[i].y - wps[i - 1].y);
+    }
+    num_wps = n_waypoints;
+    return true;
+}
+
+MobPoint mobility_ue_position(double t)
+{
+    double total = wp_dist[num_wps - 1];
+    double s = mp.speed * t;
+    if (total <= 0 || s <= 0)
+        return wps[0];
+    if (mp.loops > 0 && s >= total * mp.loops)
+        return wps[num_wps - 1];
+    s = fmod(s, total);
+    int i = 1;
+    while (i < num_wps - 1 && wp_dist[i] < s) {
+        i++;
+    }
+    double seg = wp_dist[i] - wp_dist[i - 1];
+    double w = seg > 0 ? (s - wp_dist[i - 1]) / seg : 0;
+    MobPoint pos = {
+        .x = wps[i - 1].x + w * (wps[i].x - wps[i - 1].x),
+        .y = wps[i - 1].y + w * (wps[i].y - wps[i - 1].y)
+    };
+    return pos;
+}
+
+bool mobility_path_loss(double t, double *path_loss, int n)
+{
+    if (num_wps == 0)
+        return false;
+    if (n > num_aps) {
+        n = num_aps;
+    }
+    MobPoint ue = mobility_ue_position(t);
+    // 10 * exp * log10(d / d0) == 5 * exp * log10(d^2 / d0^2), no sqrt needed
+    double k = 5 * mp.pl_exp;
+    double c = mp.pl_ref - mp.pl_offset;
+    double d0_sq = mp.pl_d0 * mp.pl_d0;
+    for (int i = 0; i < n; i++) {
+        double dx = ap_x[i] - ue.x;
+        double dy = ap_y[i] - ue.y;
+        double d_sq = dx * dx + dy * dy;
+        // Within the reference distance the path loss is constant
+        path_loss[i] = c + k * log10((d_sq > d0_sq ? d_sq : d0_sq) / d0_sq);
+    }
+    // The model ends when the last waypoint of the last pass is reached
+    return mp.loops == 0 || mp.speed * t < wp_dist[num_wps - 1] * mp.loops;
+}
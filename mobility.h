@@ -0,0 +1,35 @@
+#ifndef _MOBILITY_H_
+#define _MOBILITY_H_
+
+#include <stdbool.h>
+
+#include "adacom.h"
+
+#define MOBILITY_MAX_WAYPOINTS 64
+
+
+typedef struct {
+    double x;
+    double y;
+} MobPoint;
+
+typedef struct {
+    // Log-distance path loss: ref + 10 * exp * log10(d / d0) - offset
+    double pl_ref;
+    double pl_exp;
+    double pl_d0;
+    double pl_offset;
+    // Speed of the UE in m/s along the waypoints and the number of passes
+    // along them (0 means endless)
+    double speed;
+    int loops;
+} MobParams;
+
+
+bool mobility_init(const MobParams *params, const MobPoint *aps, int n_aps,
+        const MobPoint *waypoints, int n_waypoints);
+
+MobPoint mobility_ue_position(double t);
+bool mobility_path_loss(double t, double *path_loss, int n);
+
+#endif /* _MOBILITY_H_ */
@@ -0,0 +1,83 @@
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <masc.h>
+
+#include "cfg.h"
+#include "profile.h"
+
+
+static Str *profile_path(const char *model)
+{
+    // The model string is used as file name, keep it a plain one
+    Str *name = str_new("%s.json", model);
+    for (char *c = name->cstr; *c != '\0'; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '.' && *c != '-') {
+            *c = '_';
+        }
+    }
+    Str *path = path_join(cfg.profile_dir, name->cstr);
+    delete(name);
+    return path;
+}
+
+static bool make_dirs(const char *path)
+{
+    // Create the parents as well, e.g. ~/.cache of a fresh account
+    char dir[strlen(path) + 1];
+    strcpy(dir, path);
+    for (char *c = dir + 1; *c != '\0'; c++) {
+        if (*c != '/')
+            continue;
+        *c = '\0';
+        if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+            return false;
+        *c = '/';
+    }
+    return mkdir(dir, 0755) == 0 || errno == EEXIST;
+}
+
+FILE *profile_create(const char *model)
+{
+    if (!make_dirs(cfg.profile_dir))
+        return NULL;
+    Str *path = profile_path(model);
+    FILE *f = fopen(path->cstr, "w");
+    delete(path);
+    return f;
+}
+
+static bool get_num(Json *js, const char *key, double *value)
+{
+    Object *obj = json_get_node(js, key);
+    if (!isinstance(obj, Num))
+        return false;
+    *value = to_double((Num *)obj);
+    return true;
+}
+
+bool profile_load(const char *model, AdaProfile *profile)
+{
+    if (model == NULL)
+        return false;
+    Str *path = profile_path(model);
+    FILE *f = fopen(path->cstr, "r");
+    delete(path);
+    if (f == NULL)
+        return false;
+    char buf[8192];
+    size_t size = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[size] = '\0';
+    bool ok = false;
+    Json *js = json_new_cstr(buf);
+    if (json_is_valid(js)) {
+        ok = get_num(js, "set_p50", &profile->set_p50)
+                && get_num(js, "set_p99", &profile->set_p99)
+                && get_num(js, "set_max", &profile->set_max)
+                && get_num(js, "max_rate", &profile->max_rate);
+    }
+    delete(js);
+    return ok;
+}
@@ -0,0 +1,26 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * Timing profiles of Adaura models as measured by "adacon characterise",
+ * one JSON file per model string in the profile directory.
+ */
+
+
+typedef struct {
+    // Reply latency of a set command in ms
+    double set_p50;
+    double set_p99;
+    double set_max;
+    // Maximum sustainable rate of back-to-back set commands per second
+    double max_rate;
+} AdaProfile;
+
+
+FILE *profile_create(const char *model);
+bool profile_load(const char *model, AdaProfile *profile);
+
+#endif /* _PROFILE_H_ */
@@ -0,0 +1,205 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "series.h"
+
+// Pages behind the cursor are released every time it advanced this far
+#define RELEASE_SIZE (1 << 20)
+
+
+typedef struct {
+    double t;
+    double values[SERIES_MAX_COLUMNS];
+} Sample;
+
+
+static const char *data = NULL;
+static size_t data_size = 0;
+static bool binary = false;
+static size_t data_start = 0;
+static size_t cursor = 0;
+static size_t released = 0;
+static int n_columns = 0;
+// Only the two samples around the current time are kept in memory
+static Sample prev, next;
+static bool has_next = false;
+
+
+static const char *parse_number(const char *p, const char *end, double *value)
+{
+    char buf[64];
+    size_t n = 0;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    while (p < end && n < sizeof(buf) - 1 && strchr("+-.0123456789eE", *p)) {
+        buf[n++] = *p++;
+    }
+    buf[n] = '\0';
+    char *num_end;
+    *value = strtod(buf, &num_end);
+    return (n > 0 && *num_end == '\0') ? p : NULL;
+}
+
+static const char *line_end(const char *p, const char *end)
+{
+    const char *nl = memchr(p, '\n', end - p);
+    return nl != NULL ? nl : end;
+}
+
+/* Parse one CSV line, returns the number of path loss columns or -1 */
+static int parse_csv_line(const char *p, const char *end, Sample *s)
+{
+    p = parse_number(p, end, &s->t);
+    if (p == NULL)
+        return -1;
+    int n = 0;
+    while (p < end && *p != '\r' && n < SERIES_MAX_COLUMNS) {
+        if (*p != ',' && *p != ';')
+            return -1;
+        p = parse_number(p + 1, end, &s->values[n]);
+        if (p == NULL)
+            return -1;
+        n++;
+    }
+    return n;
+}
+
+static bool read_binary(Sample *s)
+{
+    size_t rec_size = sizeof(double) + n_columns * sizeof(float);
+    if (cursor + rec_size > data_size)
+        return false;
+    float vals[SERIES_MAX_COLUMNS];
+    memcpy(&s->t, data + cursor, sizeof(double));
+    memcpy(vals, data + cursor + sizeof(double), n_columns * sizeof(float));
+    for (int i = 0; i < n_columns; i++) {
+        s->values[i] = vals[i];
+    }
+    cursor += rec_size;
+    return true;
+}
+
+static bool read_csv(Sample *s)
+{
+    const char *end = data + data_size;
+    while (cursor < data_size) {
+        const char *p = data + cursor;
+        const char *eol = line_end(p, end);
+        cursor = eol - data + 1;
+        int n = parse_csv_line(p, eol, s);
+        if (n < 0)
+            continue;
+        if (n_columns == 0) {
+            n_columns = n;
+        }
+        if (n == n_columns)
+            return true;
+    }
+    return false;
+}
+
+static bool read_sample(Sample *s)
+{
+    bool ok = binary ? read_binary(s) : read_csv(s);
+    // Keep the memory footprint constant for long recordings
+    if (cursor - released >= RELEASE_SIZE) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t upto = (cursor / page) * page;
+        madvise((void *)(data + released), upto - released, MADV_DONTNEED);
+        released = upto;
+    }
+    return ok;
+}
+
+bool series_open(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    data = addr;
+    data_size = st.st_size;
+    size_t magic_len = strlen(SERIES_MAGIC);
+    binary = data_size >= magic_len + sizeof(uint32_t)
+            && memcmp(data, SERIES_MAGIC, magic_len) == 0;
+    if (binary) {
+        uint32_t n;
+        memcpy(&n, data + magic_len, sizeof(n));
+        n_columns = n;
+        data_start = magic_len + sizeof(uint32_t);
+    } else {
+        n_columns = 0;
+        data_start = 0;
+    }
+    series_rewind();
+    if (n_columns <= 0 || n_columns > SERIES_MAX_COLUMNS) {
+        series_close();
+        return false;
+    }
+    return true;
+}
+
+void series_close(void)
+{
+    if (data == NULL)
+        return;
+    munmap((void *)data, data_size);
+    data = NULL;
+    data_size = 0;
+}
+
+int series_num_columns(void)
+{
+    return n_columns;
+}
+
+void series_rewind(void)
+{
+    cursor = data_start;
+    released = 0;
+    has_next = read_sample(&prev);
+    if (has_next) {
+        has_next = read_sample(&next);
+        // A series with a single sample is constant
+        if (!has_next) {
+            next = prev;
+        }
+    }
+}
+
+bool series_sample(double t, double *values, int n)
+{
+    if (data == NULL)
+        return false;
+    // Move forward until t lies between the previous and the next sample
+    while (has_next && next.t <= t) {
+        prev = next;
+        has_next = read_sample(&next);
+    }
+    if (!has_next && t > prev.t)
+        return false;
+    if (n > n_columns) {
+        n = n_columns;
+    }
+    double span = next.t - prev.t;
+    double w = (span > 0 && t > prev.t) ? (t - prev.t) / span : 0;
+    for (int i = 0; i < n; i++) {
+        values[i] = prev.values[i] + w * (next.values[i] - prev.values[i]);
+    }
+    return true;
+}
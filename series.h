@@ -0,0 +1,25 @@
+#ifndef _SERIES_H_
+#define _SERIES_H_
+
+#include <stdbool.h>
+
+#define SERIES_MAGIC "ADASER1\n"
+#define SERIES_MAX_COLUMNS 16
+
+/*
+ * A series is either a CSV file with the time in seconds in the first
+ * column followed by one path loss column [dB] per channel (lines which do
+ * not start with a number are skipped), or a binary file with SERIES_MAGIC,
+ * the number of columns as uint32 and then records of a double time and
+ * one float per column.
+ */
+
+
+bool series_open(const char *path);
+void series_close(void);
+
+int series_num_columns(void);
+void series_rewind(void);
+bool series_sample(double t, double *values, int n);
+
+#endif /* _SERIES_H_ */
@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "serio.h"
+
+
+typedef struct {
+    SerioEvent slots[SERIO_SLOTS];
+    atomic_size_t head;
+    atomic_size_t tail;
+} SerioRing;
+
+
+static int fd = -1;
+// Wakes up the I/O thread for new commands
+static int wake_fd = -1;
+// Signals the main loop that events are available (owned by the caller)
+static int notify_fd = -1;
+static pthread_t thread;
+static atomic_bool running = false;
+static atomic_ulong dropped = 0;
+static const char *sched_error = NULL;
+// Commands: main loop -> I/O thread, events: I/O thread -> main loop
+static SerioRing cmds;
+static SerioRing events;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool ring_push(SerioRing *ring, uint32_t type, const char *data,
+        size_t len, uint64_t ts_ns)
+{
+    size_t h = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t t = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (h - t >= SERIO_SLOTS)
+        return false;
+    SerioEvent *slot = &ring->slots[h & (SERIO_SLOTS - 1)];
+    if (len > SERIO_LINE_MAX) {
+        len = SERIO_LINE_MAX;
+    }
+    slot->ts_ns = ts_ns;
+    slot->type = type;
+    slot->len = len;
+    memcpy(slot->data, data, len);
+    atomic_store_explicit(&ring->head, h + 1, memory_order_release);
+    return true;
+}
+
+static bool ring_pop(SerioRing *ring, SerioEvent *event)
+{
+    size_t t = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t h = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (t == h)
+        return false;
+    *event = ring->slots[t & (SERIO_SLOTS - 1)];
+    atomic_store_explicit(&ring->tail, t + 1, memory_order_release);
+    return true;
+}
+
+static void signal_fd(int efd)
+{
+    uint64_t one = 1;
+    while (write(efd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+static void push_event(uint32_t type, const char *data, size_t len,
+        uint64_t ts_ns)
+{
+    if (!ring_push(&events, type, data, len, ts_ns)) {
+        atomic_fetch_add(&dropped, 1);
+        return;
+    }
+    signal_fd(notify_fd);
+}
+
+static bool write_cmds(void)
+{
+    SerioEvent cmd;
+    while (ring_pop(&cmds, &cmd)) {
+        size_t off = 0;
+        while (off < cmd.len) {
+            ssize_t n = write(fd, cmd.data + off, cmd.len - off);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN) {
+                struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            // Half a command on the wire, the link is unusable
+            if (n <= 0)
+                return false;
+            off += n;
+        }
+    }
+    return true;
+}
+
+static bool read_lines(char *line, size_t *line_len)
+{
+    char buf[SERIO_LINE_MAX];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        return true;
+    if (n <= 0)
+        return false;
+    uint64_t ts = now_ns();
+    for (ssize_t i = 0; i < n; i++) {
+        line[(*line_len)++] = buf[i];
+        // Overlong lines are split
+        if (buf[i] == '\n' || *line_len == SERIO_LINE_MAX) {
+            push_event(SERIO_EVT_LINE, line, *line_len, ts);
+            *line_len = 0;
+        }
+    }
+    return true;
+}
+
+static void *io_main(void *arg)
+{
+    char line[SERIO_LINE_MAX];
+    size_t line_len = 0;
+    struct pollfd pfds[2] = {
+        { .fd = fd, .events = POLLIN },
+        { .fd = wake_fd, .events = POLLIN }
+    };
+    while (atomic_load(&running)) {
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (pfds[1].revents & POLLIN) {
+            uint64_t count;
+            while (read(wake_fd, &count, sizeof(count)) < 0 && errno == EINTR);
+            if (!write_cmds()) {
+                push_event(SERIO_EVT_EOF, NULL, 0, now_ns());
+                break;
+            }
+        }
+        if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            if (!read_lines(line, &line_len)) {
+                push_event(SERIO_EVT_EOF, NULL, 0, now_ns());
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool setup_tty(void)
+{
+    struct termios tio;
+    if (tcgetattr(fd, &tio) < 0)
+        return false;
+    // 115200 baud, 8N1, raw
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, B115200);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(PARENB | CSTOPB | CRTSCTS);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+static void setup_sched(const SerioParams *params)
+{
+    sched_error = NULL;
+    if (params->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(params->cpu, &set);
+        if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0) {
+            sched_error = "unable to pin the I/O thread";
+        }
+    }
+    if (params->rt_priority > 0) {
+        struct sched_param sp = { .sched_priority = params->rt_priority };
+        if (pthread_setschedparam(thread, SCHED_FIFO, &sp) != 0) {
+            sched_error = "unable to set the real-time priority";
+        }
+    }
+}
+
+int serio_open(const char *device, const SerioParams *params)
+{
+    if (fd >= 0)
+        return -1;
+    fd = open(device, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!setup_tty() || wake_fd < 0 || notify_fd < 0)
+        goto err;
+    atomic_store(&cmds.head, 0);
+    atomic_store(&cmds.tail, 0);
+    atomic_store(&events.head, 0);
+    atomic_store(&events.tail, 0);
+    atomic_store(&running, true);
+    if (pthread_create(&thread, NULL, io_main, NULL) != 0) {
+        atomic_store(&running, false);
+        goto err;
+    }
+    setup_sched(params);
+    return notify_fd;
+err:
+    if (notify_fd >= 0) {
+        close(notify_fd);
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
+    close(fd);
+    fd = wake_fd = notify_fd = -1;
+    return -1;
+}
+
+const char *serio_sched_error(void)
+{
+    return sched_error;
+}
+
+bool serio_write(const char *data, size_t len)
+{
+    if (fd < 0 || !ring_push(&cmds, SERIO_EVT_LINE, data, len, now_ns()))
+        return false;
+    signal_fd(wake_fd);
+    return true;
+}
+
+bool serio_next(SerioEvent *event)
+{
+    return ring_pop(&events, event);
+}
+
+unsigned long serio_dropped(void)
+{
+    return atomic_load(&dropped);
+}
+
+void serio_close(void)
+{
+    if (fd < 0)
+        return;
+    atomic_store(&running, false);
+    signal_fd(wake_fd);
+    pthread_join(thread, NULL);
+    close(wake_fd);
+    close(fd);
+    // The notify fd is closed by the caller
+    fd = wake_fd = notify_fd = -1;
+}
@@ -0,0 +1,48 @@
+#ifndef _SERIO_H_
+#define _SERIO_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Serial transport on its own thread. Commands are passed to the I/O thread
+ * and received lines back to the main loop through single producer, single
+ * consumer rings, so reading the device never waits for the main loop.
+ */
+
+#define SERIO_LINE_MAX 256
+// Number of slots of each ring (has to be a power of two)
+#define SERIO_SLOTS 64
+
+
+typedef enum {
+    SERIO_EVT_LINE,
+    SERIO_EVT_EOF
+} SerioEventType;
+
+typedef struct {
+    // CLOCK_MONOTONIC time of the reception
+    uint64_t ts_ns;
+    uint32_t type;
+    uint32_t len;
+    char data[SERIO_LINE_MAX];
+} SerioEvent;
+
+typedef struct {
+    // CPU to pin the thread to (negative: no pinning)
+    int cpu;
+    // SCHED_FIFO priority (0: normal scheduling)
+    int rt_priority;
+} SerioParams;
+
+
+int serio_open(const char *device, const SerioParams *params);
+const char *serio_sched_error(void);
+bool serio_write(const char *data, size_t len);
+bool serio_next(SerioEvent *event);
+// Received lines which did not fit into the ring (total since the start)
+unsigned long serio_dropped(void);
+void serio_close(void);
+
+#endif /* _SERIO_H_ */
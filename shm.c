@@ -0,0 +1,86 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shm.h"
+
+
+static ShmState *shm = NULL;
+
+
+bool shm_init(const char *path)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, sizeof(ShmState)) < 0) {
+        close(fd);
+        return false;
+    }
+    void *addr = mmap(NULL, sizeof(ShmState), PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+    shm = addr;
+    // Keep the content if a producer already has initialised the region
+    if (shm->magic != SHM_MAGIC || shm->version != SHM_VERSION) {
+        memset(shm, 0, sizeof(ShmState));
+        shm->version = SHM_VERSION;
+        atomic_thread_fence(memory_order_release);
+        shm->magic = SHM_MAGIC;
+    }
+    return true;
+}
+
+void shm_destroy(void)
+{
+    if (shm == NULL)
+        return;
+    munmap(shm, sizeof(ShmState));
+    shm = NULL;
+}
+
+void shm_set_num_channels(int n)
+{
+    if (shm != NULL) {
+        shm->num_channels = n;
+    }
+}
+
+bool shm_read_desired(double *values, int n, uint64_t *generation)
+{
+    if (shm == NULL || n > ADACOM_MAX_CHANNELS)
+        return false;
+    // A producer which died while writing leaves seq odd, so never wait for
+    // it on the main loop. The caller keeps its previous values.
+    for (int retry = 0; retry < SHM_READ_RETRIES; retry++) {
+        unsigned int seq_start = atomic_load_explicit(&shm->seq,
+                memory_order_acquire);
+        if (seq_start & 1) {
+            // The producer is writing, try again
+            continue;
+        }
+        *generation = shm->generation;
+        memcpy(values, shm->desired, n * sizeof(double));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&shm->seq, memory_order_relaxed) == seq_start)
+            return true;
+    }
+    return false;
+}
+
+void shm_publish_applied(const double *values, int n, uint64_t generation)
+{
+    if (shm == NULL || n > ADACOM_MAX_CHANNELS)
+        return;
+    unsigned int seq = atomic_load_explicit(&shm->applied_seq,
+            memory_order_relaxed);
+    atomic_store_explicit(&shm->applied_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(shm->applied, values, n * sizeof(double));
+    shm->applied_generation = generation;
+    atomic_store_explicit(&shm->applied_seq, seq + 2, memory_order_release);
+}
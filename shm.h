@@ -0,0 +1,51 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "adacom.h"
+
+#define SHM_MAGIC 0x41444153
+#define SHM_VERSION 1
+// Attempts to read a consistent vector before giving up
+#define SHM_READ_RETRIES 100
+
+/*
+ * Shared memory region for external producers of attenuation values.
+ *
+ * Producer (lock-free, no syscalls):
+ *   seq++ (odd), release fence, write desired[], generation++,
+ *   seq++ (even, release store)
+ * The fence keeps the writes of the values behind the odd seq. adacon
+ * publishes the values which have been set on the device in the same way
+ * with applied_seq, applied[] and applied_generation. The region is only
+ * accessible for the owner and its group.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_channels;
+    uint32_t reserved;
+    // Written by the producer
+    atomic_uint seq;
+    uint32_t pad;
+    uint64_t generation;
+    double desired[ADACOM_MAX_CHANNELS];
+    // Written by adacon
+    atomic_uint applied_seq;
+    uint32_t applied_pad;
+    uint64_t applied_generation;
+    double applied[ADACOM_MAX_CHANNELS];
+} ShmState;
+
+
+bool shm_init(const char *path);
+void shm_destroy(void);
+
+void shm_set_num_channels(int n);
+bool shm_read_desired(double *values, int n, uint64_t *generation);
+void shm_publish_applied(const double *values, int n, uint64_t generation);
+
+#endif /* _SHM_H_ */
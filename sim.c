@@ -0,0 +1,285 @@
+#include <string.h>
+
+#include "sim.h"
+
+// Command and (approximated) response of a set command on the wire
+#define SIM_CMD_FMT "set %i %.2f"
+#define SIM_RESP_FMT "Channel %i attenuation set to %.2f\r\n"
+
+
+typedef struct {
+    void *timer;
+    sim_timer_cb cb;
+    int64_t due;
+    bool pending;
+} SimTimer;
+
+
+static SimParams sp;
+static FILE *tl = NULL;
+// Virtual time in us
+static int64_t now = 0;
+static SimTimer timers[SIM_MAX_TIMERS];
+static int num_timers = 0;
+// Device state, the channels of a set all command are set one after another
+static double attenuations[ADACOM_MAX_CHANNELS];
+static double req_attenuations[ADACOM_MAX_CHANNELS];
+static bool running = false;
+static int cur_channel;
+static int cur_pos;
+// Send order of a set all (see adacom_group_order())
+static int send_order[ADACOM_MAX_CHANNELS];
+static int64_t req_time;
+static int64_t done_time;
+static adacom_channels_cb done_cb = NULL;
+static adacom_applied_cb applied_cb = NULL;
+static SimStats stats;
+
+
+void sim_init(const SimParams *params, FILE *timeline)
+{
+    sp = *params;
+    tl = timeline;
+    now = 0;
+    num_timers = 0;
+    running = false;
+    for (int ch = 0; ch < ADACOM_MAX_CHANNELS; ch++) {
+        attenuations[ch] = ADACOM_MAX_ATTENUATION;
+        send_order[ch] = ch;
+    }
+    memset(&stats, 0, sizeof(stats));
+    hist_reset(&stats.latency);
+    if (tl != NULL) {
+        fprintf(tl, "# time [ms], channel, attenuation [dB], latency [ms]\n");
+    }
+}
+
+void sim_set_applied_cb(adacom_applied_cb cb)
+{
+    applied_cb = cb;
+}
+
+void sim_destroy(void)
+{
+    applied_cb = NULL;
+    num_timers = 0;
+    running = false;
+    tl = NULL;
+}
+
+int sim_run_time(void)
+{
+    return now / 1000;
+}
+
+double sim_validate_attenuation(double value)
+{
+    // Same limits and quarter steps as the device
+    if (value > ADACOM_MAX_ATTENUATION) {
+        value = ADACOM_MAX_ATTENUATION;
+    } else if (value < ADACOM_MIN_ATTENUATION) {
+        value = ADACOM_MIN_ATTENUATION;
+    }
+    int a_int = value;
+    int ivals = (value - a_int) / ADACOM_MIN_INTERVAL;
+    return a_int + ivals * ADACOM_MIN_INTERVAL;
+}
+
+void sim_set_order(const int *order, int n)
+{
+    for (int pos = 0; pos < ADACOM_MAX_CHANNELS; pos++) {
+        send_order[pos] = pos < n ? order[pos] : pos;
+    }
+}
+
+static int skip_good_values(int pos)
+{
+    for (; pos < ADACOM_MAX_CHANNELS; pos++) {
+        int ch = send_order[pos];
+        if (ch < sp.num_channels && req_attenuations[ch] != attenuations[ch])
+            return pos;
+    }
+    return pos;
+}
+
+double sim_cmd_time(const SimParams *params, int ch, double value,
+        int *bytes)
+{
+    int tx = snprintf(NULL, 0, SIM_CMD_FMT, ch + 1, value);
+    int rx = snprintf(NULL, 0, SIM_RESP_FMT, ch + 1, value);
+    if (bytes != NULL) {
+        *bytes = tx + rx;
+    }
+    // 8N1: 10 bits per byte on the wire
+    return (tx + rx) * 10 * 1000.0 / params->baudrate + params->cmd_latency;
+}
+
+static int64_t cmd_duration(int ch, double value)
+{
+    int bytes;
+    int tx = snprintf(NULL, 0, SIM_CMD_FMT, ch + 1, value);
+    double ms = sim_cmd_time(&sp, ch, value, &bytes);
+    stats.cmds++;
+    stats.bytes_tx += tx;
+    stats.bytes_rx += bytes - tx;
+    return (int64_t)(ms * 1000);
+}
+
+static void send_cmd(int64_t start)
+{
+    int64_t duration = cmd_duration(cur_channel, req_attenuations[cur_channel]);
+    stats.busy_time += duration / 1000.0;
+    done_time = start + duration;
+}
+
+static void complete_cmd(void)
+{
+    int ch = cur_channel;
+    attenuations[ch] = req_attenuations[ch];
+    hist_record(&stats.latency, now - req_time);
+    if (applied_cb != NULL) {
+        // Virtual time instead of CLOCK_REALTIME
+        applied_cb(ch, attenuations[ch], req_time * 1000, now * 1000);
+    }
+    if (tl != NULL) {
+        fprintf(tl, "%.3f %i %.2f %.3f\n", now / 1000.0, ch + 1,
+                attenuations[ch], (now - req_time) / 1000.0);
+    }
+    cur_pos = skip_good_values(cur_pos + 1);
+    if (cur_pos < ADACOM_MAX_CHANNELS) {
+        cur_channel = send_order[cur_pos];
+        send_cmd(now);
+        return;
+    }
+    running = false;
+    if (done_cb != NULL) {
+        done_cb(ADACOM_OK, attenuations, sp.num_channels);
+    }
+}
+
+static SimTimer *next_timer(void)
+{
+    SimTimer *next = NULL;
+    for (int i = 0; i < num_timers; i++) {
+        if (timers[i].pending && (next == NULL || timers[i].due < next->due)) {
+            next = &timers[i];
+        }
+    }
+    return next;
+}
+
+bool sim_run(int until)
+{
+    int64_t end = (int64_t)until * 1000;
+    for (;;) {
+        SimTimer *timer = next_timer();
+        if (timer == NULL && !running)
+            return false;
+        // The device answers before timers which expire at the same instant
+        bool device = running && (timer == NULL || done_time <= timer->due);
+        int64_t t = device ? done_time : timer->due;
+        if (t > end) {
+            now = end;
+            return true;
+        }
+        now = t;
+        if (device) {
+            complete_cmd();
+        } else {
+            timer->pending = false;
+            timer->cb(timer->timer, NULL);
+        }
+    }
+}
+
+static SimTimer *get_timer(void *timer)
+{
+    for (int i = 0; i < num_timers; i++) {
+        if (timers[i].timer == timer)
+            return &timers[i];
+    }
+    return NULL;
+}
+
+void sim_timer_new(void *timer, sim_timer_cb cb)
+{
+    if (get_timer(timer) != NULL || num_timers >= SIM_MAX_TIMERS)
+        return;
+    timers[num_timers++] = (SimTimer){
+        .timer = timer, .cb = cb, .due = 0, .pending = false
+    };
+}
+
+void sim_timer_in(void *timer, int ms)
+{
+    SimTimer *t = get_timer(timer);
+    if (t == NULL)
+        return;
+    t->due = now + (int64_t)ms * 1000;
+    t->pending = true;
+}
+
+void sim_timer_add(void *timer, int ms)
+{
+    // Relative to the last expiry, so that periodic timers do not drift
+    SimTimer *t = get_timer(timer);
+    if (t == NULL)
+        return;
+    t->due += (int64_t)ms * 1000;
+    t->pending = true;
+}
+
+bool sim_is_busy(void)
+{
+    return running;
+}
+
+AdaComError sim_get_all(double *values, int n)
+{
+    if (n != sp.num_channels)
+        return ADACOM_ERR_NUM_CHANNELS;
+    for (int ch = 0; ch < n; ch++) {
+        values[ch] = attenuations[ch];
+    }
+    return ADACOM_OK;
+}
+
+AdaComError sim_get_target(double *values, int n)
+{
+    AdaComError err = sim_get_all(values, n);
+    if (err != ADACOM_OK || !running)
+        return err;
+    for (int pos = cur_pos; pos < ADACOM_MAX_CHANNELS; pos++) {
+        if (send_order[pos] < n) {
+            values[send_order[pos]] = req_attenuations[send_order[pos]];
+        }
+    }
+    return ADACOM_OK;
+}
+
+AdaComError sim_set_all(double *values, int n, adacom_channels_cb chs_cb)
+{
+    if (n != sp.num_channels)
+        return ADACOM_ERR_NUM_CHANNELS;
+    if (running) {
+        stats.busy++;
+        return ADACOM_ERR_DEVICE_BUSY;
+    }
+    for (int ch = 0; ch < n; ch++) {
+        req_attenuations[ch] = sim_validate_attenuation(values[ch]);
+    }
+    cur_pos = skip_good_values(0);
+    if (cur_pos >= ADACOM_MAX_CHANNELS)
+        return ADACOM_OK;
+    cur_channel = send_order[cur_pos];
+    running = true;
+    req_time = now;
+    done_cb = chs_cb;
+    send_cmd(now);
+    return ADACOM_OK;
+}
+
+const SimStats *sim_get_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,67 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "adacom.h"
+#include "hist.h"
+
+#define SIM_MAX_TIMERS 16
+
+/*
+ * Virtual time simulation of the event loop timers and of an Adaura device.
+ * Nothing sleeps: the clock jumps from one event to the next, so scenarios
+ * of hours are played within seconds.
+ */
+
+
+typedef void (*sim_timer_cb)(void *timer, void *arg);
+
+typedef struct {
+    int num_channels;
+    int baudrate;
+    // Time in ms the device needs to process a set command
+    double cmd_latency;
+} SimParams;
+
+typedef struct {
+    unsigned long cmds;
+    unsigned long busy;
+    unsigned long bytes_tx;
+    unsigned long bytes_rx;
+    // Time in ms the device was occupied by commands (transfer and latency)
+    double busy_time;
+    // Latency from the request to the confirmation of a channel in us
+    Hist latency;
+} SimStats;
+
+
+void sim_init(const SimParams *params, FILE *timeline);
+void sim_destroy(void);
+void sim_set_applied_cb(adacom_applied_cb cb);
+// Send order of the channels of a set all (identity by default)
+void sim_set_order(const int *order, int n);
+
+int sim_run_time(void);
+bool sim_run(int until);
+
+void sim_timer_new(void *timer, sim_timer_cb cb);
+void sim_timer_in(void *timer, int ms);
+void sim_timer_add(void *timer, int ms);
+
+bool sim_is_busy(void);
+AdaComError sim_get_all(double *values, int n);
+AdaComError sim_get_target(double *values, int n);
+AdaComError sim_set_all(double *values, int n, adacom_channels_cb chs_cb);
+
+const SimStats *sim_get_stats(void);
+
+// Value the device sets for a requested attenuation
+double sim_validate_attenuation(double value);
+// Time in ms and size in bytes of a set command including its response
+double sim_cmd_time(const SimParams *params, int ch, double value,
+        int *bytes);
+
+#endif /* _SIM_H_ */
@@ -0,0 +1,151 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+// Size of the ring buffer (has to be a power of two)
+#define RING_SIZE (1 << 16)
+#define FLUSH_INTERVAL_NS 20000000
+
+
+static FILE *file = NULL;
+static pthread_t writer;
+static atomic_bool running = false;
+// Single producer (main loop), single consumer (writer thread)
+static char ring[RING_SIZE];
+static atomic_size_t head = 0;
+static atomic_size_t tail = 0;
+static atomic_ulong dropped = 0;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void ring_put(size_t pos, const void *data, size_t len)
+{
+    size_t off = pos & (RING_SIZE - 1);
+    size_t first = len < RING_SIZE - off ? len : RING_SIZE - off;
+    memcpy(ring + off, data, first);
+    memcpy(ring, (const char *)data + first, len - first);
+}
+
+static void flush_ring(void)
+{
+    size_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+    size_t h = atomic_load_explicit(&head, memory_order_acquire);
+    while (t != h) {
+        size_t off = t & (RING_SIZE - 1);
+        size_t len = h - t < RING_SIZE - off ? h - t : RING_SIZE - off;
+        fwrite(ring + off, 1, len, file);
+        t += len;
+    }
+    atomic_store_explicit(&tail, t, memory_order_release);
+    fflush(file);
+}
+
+static void *writer_main(void *arg)
+{
+    struct timespec interval = { 0, FLUSH_INTERVAL_NS };
+    while (atomic_load(&running)) {
+        nanosleep(&interval, NULL);
+        flush_ring();
+    }
+    // Write whatever has been recorded in the meantime
+    flush_ring();
+    return NULL;
+}
+
+bool trace_open(const char *path)
+{
+    if (file != NULL)
+        return false;
+    file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), file);
+    atomic_store(&running, true);
+    if (pthread_create(&writer, NULL, writer_main, NULL) != 0) {
+        atomic_store(&running, false);
+        fclose(file);
+        file = NULL;
+        return false;
+    }
+    return true;
+}
+
+void trace_record(TraceDir dir, const void *data, size_t len)
+{
+    if (file == NULL)
+        return;
+    if (len > TRACE_MAX_LINE) {
+        len = TRACE_MAX_LINE;
+    }
+    TraceRecord rec = { .ts_ns = now_ns(), .dir = dir, .len = len };
+    size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+    size_t t = atomic_load_explicit(&tail, memory_order_acquire);
+    // Never block the caller, drop the record if the writer is behind.
+    if (RING_SIZE - (h - t) < sizeof(rec) + len) {
+        atomic_fetch_add(&dropped, 1);
+        return;
+    }
+    ring_put(h, &rec, sizeof(rec));
+    ring_put(h + sizeof(rec), data, len);
+    atomic_store_explicit(&head, h + sizeof(rec) + len, memory_order_release);
+}
+
+unsigned long trace_dropped(void)
+{
+    return atomic_load(&dropped);
+}
+
+void trace_close(void)
+{
+    if (file == NULL)
+        return;
+    atomic_store(&running, false);
+    pthread_join(writer, NULL);
+    fclose(file);
+    file = NULL;
+}
+
+bool trace_reader_open(TraceReader *self, const char *path)
+{
+    char magic[sizeof(TRACE_MAGIC) - 1];
+    self->file = fopen(path, "rb");
+    if (self->file == NULL)
+        return false;
+    if (fread(magic, 1, sizeof(magic), self->file) != sizeof(magic)
+            || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+        trace_reader_close(self);
+        return false;
+    }
+    return true;
+}
+
+bool trace_reader_next(TraceReader *self)
+{
+    if (self->file == NULL)
+        return false;
+    if (fread(&self->rec, sizeof(TraceRecord), 1, self->file) != 1)
+        return false;
+    if (self->rec.len > TRACE_MAX_LINE)
+        return false;
+    if (fread(self->data, 1, self->rec.len, self->file) != self->rec.len)
+        return false;
+    self->data[self->rec.len] = '\0';
+    return true;
+}
+
+void trace_reader_close(TraceReader *self)
+{
+    if (self->file != NULL) {
+        fclose(self->file);
+        self->file = NULL;
+    }
+}
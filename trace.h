@@ -0,0 +1,40 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_MAGIC "ADATRC1\n"
+#define TRACE_MAX_LINE 1024
+
+
+typedef enum {
+    TRACE_DIR_TX,
+    TRACE_DIR_RX
+} TraceDir;
+
+typedef struct {
+    uint64_t ts_ns;
+    uint32_t dir;
+    uint32_t len;
+} TraceRecord;
+
+typedef struct {
+    FILE *file;
+    TraceRecord rec;
+    char data[TRACE_MAX_LINE + 1];
+} TraceReader;
+
+
+bool trace_open(const char *path);
+void trace_record(TraceDir dir, const void *data, size_t len);
+unsigned long trace_dropped(void);
+void trace_close(void);
+
+bool trace_reader_open(TraceReader *self, const char *path);
+bool trace_reader_next(TraceReader *self);
+void trace_reader_close(TraceReader *self);
+
+#endif /* _TRACE_H_ */
@@ -33,6 +33,12 @@ static const char *ada_sn = NULL;
 static int ada_num_channels = 0;
 static double ada_attenuations[ADACOM_MAX_CHANNELS];
 static int selected_channel = -1;
+static bool dash_visible = false;
+static AdaComStats dash_prev;
+static double dash_cmd_rate = 0;
+static double dash_byte_rate = 0;
+static int tick_late_last = 0;
+static int tick_late_max = 0;
 // Graphics
 static int y_max, x_max;
 static int y_ada_state = 2;
@@ -49,6 +55,12 @@ static int tab_height = 4;
 static int tab_col_width = 8;
 static WINDOW *wlog = NULL;
 static int y_wlog = 14;
+static int y_dash = 2;
+static int x_dash_name = 40;
+static int x_dash_value = 52;
+static int dash_height = 5;
+static MlTimer *dash_timer = NULL;
+static int dash_interval = 1000;
 // Actions
 static List *actions = NULL;
 static tui_action_cb num_action_cb = NULL;
@@ -65,10 +77,25 @@ static void sigwinch_handler(int sig)
     }
 }
 
+static void clear_to_dashboard(void)
+{
+    // Clear the rest of the line but leave the dashboard untouched
+    if (!dash_visible) {
+        clrtoeol();
+        return;
+    }
+    int y, x;
+    getyx(stdscr, y, x);
+    (void)y;
+    if (x < x_dash_name) {
+        hline(' ', x_dash_name - x);
+    }
+}
+
 static void update_ada_state(void)
 {
     mvaddstr(y_ada_state, x_ada_value, adacom_state_to_cstr(ada_state));
-    clrtoeol();
+    clear_to_dashboard();
 }
 
 static void draw_ada_state(void)
@@ -81,11 +108,11 @@ static void update_ada_infos(void)
 {
     int y = y_ada_infos;
     mvaddstr(y++, x_ada_value, ada_model == NULL ? "---" : ada_model);
-    clrtoeol();
+    clear_to_dashboard();
     mvaddstr(y++, x_ada_value, ada_sn == NULL ? "---" : ada_sn);
-    clrtoeol();
+    clear_to_dashboard();
     mvprintw(y++, x_ada_value, "%i", ada_num_channels);
-    clrtoeol();
+    clear_to_dashboard();
 }
 
 static void draw_ada_infos(void)
@@ -97,6 +124,68 @@ static void draw_ada_infos(void)
     update_ada_infos();
 }
 
+static void sample_dashboard(void)
+{
+    AdaComStats st;
+    adacom_get_stats(&st);
+    double secs = dash_interval / 1000.0;
+    dash_cmd_rate = (st.cmds - dash_prev.cmds) / secs;
+    dash_byte_rate = (st.bytes_tx - dash_prev.bytes_tx
+            + st.bytes_rx - dash_prev.bytes_rx) / secs;
+    dash_prev = st;
+}
+
+static void update_dashboard(void)
+{
+    // Each byte takes 10 bits on the wire (8N1)
+    double bus_load = dash_byte_rate * 10 * 100 / ADACOM_BAUDRATE;
+    int y = y_dash;
+    mvprintw(y++, x_dash_value, "%.1f / %.1f / %.1f", dash_prev.rtt_last,
+            dash_prev.rtt_p50, dash_prev.rtt_p99);
+    clrtoeol();
+    mvprintw(y++, x_dash_value, "%.1f cmd/s", dash_cmd_rate);
+    clrtoeol();
+    mvprintw(y++, x_dash_value, "%.1f %% (%.0f B/s)", bus_load,
+            dash_byte_rate);
+    clrtoeol();
+    mvprintw(y++, x_dash_value, "%lu timeouts, %lu busy",
+            dash_prev.timeouts, dash_prev.busy);
+    clrtoeol();
+    mvprintw(y++, x_dash_value, "%i / %i ms", tick_late_last, tick_late_max);
+    clrtoeol();
+}
+
+static void draw_dashboard(void)
+{
+    if (!dash_visible)
+        return;
+    int y = y_dash;
+    mvaddstr(y++, x_dash_name, "RTT [ms]:");
+    mvaddstr(y++, x_dash_name, "Rate:");
+    mvaddstr(y++, x_dash_name, "Bus load:");
+    mvaddstr(y++, x_dash_name, "Errors:");
+    mvaddstr(y++, x_dash_name, "Tick late:");
+    update_dashboard();
+}
+
+static void clear_dashboard(void)
+{
+    for (int y = y_dash; y < y_dash + dash_height; y++) {
+        move(y, x_dash_name);
+        clrtoeol();
+    }
+}
+
+static void dash_timer_cb(MlTimer *timer, void *arg)
+{
+    sample_dashboard();
+    update_dashboard();
+    // Lateness maximum is shown per refresh interval
+    tick_late_max = 0;
+    refresh();
+    ml_timer_add(dash_timer, dash_interval);
+}
+
 static void print_channel_header(int ch, bool selected)
 {
     int x_col = x_tab_val + ch * tab_col_width;
@@ -169,6 +258,7 @@ static void draw(void)
     // Draw adacom state and infos
     draw_ada_state();
     draw_ada_infos();
+    draw_dashboard();
     mvhline(y_wlog - 1, 0, ACS_HLINE, x_max);
     refresh();
     // Draw channel table
@@ -258,12 +348,14 @@ void tui_init(void)
     getmaxyx(stdscr, y_max, x_max);
     title = init(Str, "%s v%s", PROJECT_TITLE, PROJECT_VERSION);
     actions = new(List);
+    dash_timer = new(MlTimer, dash_timer_cb, NULL);
     // Draw TUI
     draw();
 }
 
 void tui_destroy(void)
 {
+    delete(dash_timer);
     destroy(&title);
     destroy(&input);
     endwin();
@@ -332,6 +424,30 @@ void tui_set_attenuations(double *values, int n)
     wrefresh(wtab);
 }
 
+void tui_toggle_dashboard(void)
+{
+    dash_visible = !dash_visible;
+    if (dash_visible) {
+        adacom_get_stats(&dash_prev);
+        dash_cmd_rate = 0;
+        dash_byte_rate = 0;
+        draw_dashboard();
+        ml_timer_in(dash_timer, dash_interval);
+    } else {
+        ml_timer_cancle(dash_timer);
+        clear_dashboard();
+    }
+    refresh();
+}
+
+void tui_tick_lateness(int ms)
+{
+    tick_late_last = ms;
+    if (ms > tick_late_max) {
+        tick_late_max = ms;
+    }
+}
+
 static void _vinit(TuiAction *self, va_list va)
 {
     object_init(self, TuiActionCls);
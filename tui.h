@@ -29,4 +29,7 @@ int tui_select_channel(int channel);
 void tui_set_attenuation(int channel, double value);
 void tui_set_attenuations(double *values, int n);
 
+void tui_toggle_dashboard(void);
+void tui_tick_lateness(int ms);
+
 #endif /* _TUI_H_ */